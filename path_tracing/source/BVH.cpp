@@ -1,11 +1,35 @@
 #include "BVH.h"
+#include "Core/MappedFile.h"
+#include "Core/Profiler.h"
+#include "Core/TaskSystem.h"
 #include "Math/Aabb.h"
 #include "Math/Intersect.h"
+#include "Math/Morton.h"
+#include "Util.h"
+#include <algorithm>
+#include <bit>
 #include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <queue>
 using namespace Math;
 
 static constexpr float kLargeNumber = 1e30f;
 
+// Subtrees with fewer items are built serially by the task that reached them
+static constexpr uint32_t kParallelSubtreeItemCount = 4 * 1024;
+
+// Nodes with at least this many items also compute bounds, bins and partitions
+// in parallel. Only the few upper levels qualify, where subtree tasks alone
+// can't keep the threads busy.
+static constexpr uint32_t kParallelItemCount = 64 * 1024;
+static constexpr uint32_t kParallelGrainSize = 16 * 1024;
+
+// Only nodes with at least this many items get profiler zones, the many small
+// ones below would flood the ring buffers while taking little time in total
+static constexpr uint32_t kProfileZoneItemCount = 64 * 1024;
+
 ///////////////////////////////////////////////////////////////////////////////
 // Profiling
 ///////////////////////////////////////////////////////////////////////////////
@@ -19,6 +43,43 @@ static constexpr float kLargeNumber = 1e30f;
 #define INTERSECTION_REORDER_NODES
 
 
+///////////////////////////////////////////////////////////////////////////////
+// Build parameters
+///////////////////////////////////////////////////////////////////////////////
+const char* toString(BVHBuildMethod method)
+{
+    switch (method)
+    {
+    case BVHBuildMethod_SweepSAH:   return "Sweep SAH";
+    case BVHBuildMethod_BinnedSAH:  return "Binned SAH";
+    case BVHBuildMethod_LBVH:       return "LBVH";
+    case BVHBuildMethod_SBVH:       return "SBVH";
+    default:                        return "Unknown";
+    }
+}
+
+const char* toString(BVHNodeLayout layout)
+{
+    switch (layout)
+    {
+    case BVHNodeLayout_Build:       return "Build";
+    case BVHNodeLayout_DepthFirst:  return "Depth-first";
+    case BVHNodeLayout_VanEmdeBoas: return "van Emde Boas";
+    case BVHNodeLayout_Treelets:    return "Treelets";
+    default:                        return "Unknown";
+    }
+}
+
+const char* toString(BVHTriKernel kernel)
+{
+    switch (kernel)
+    {
+    case BVHTriKernel_MollerTrumbore:   return "Moller-Trumbore";
+    case BVHTriKernel_Watertight:       return "Watertight";
+    default:                            return "Unknown";
+    }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Item
 ///////////////////////////////////////////////////////////////////////////////
@@ -31,6 +92,33 @@ static float3 getAabbMax(const BVH::Item& item)
     return max3(item.vertex0, item.vertex1, item.vertex2);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Parallel helpers
+///////////////////////////////////////////////////////////////////////////////
+
+// Calls chunkFunc(begin, end, partial) on chunks of [begin, end) and merges
+// the partial results into result. A default constructed T must be the
+// identity of mergeFunc.
+template <typename T, typename ChunkFunc, typename MergeFunc>
+static void reduceItems(TaskSystem* taskSystem, uint32_t begin, uint32_t end, T& result, ChunkFunc chunkFunc, MergeFunc mergeFunc)
+{
+    if (!taskSystem || end - begin < kParallelItemCount)
+    {
+        chunkFunc(begin, end, result);
+        return;
+    }
+
+    std::mutex mutex;
+    taskSystem->parallelFor(begin, end, kParallelGrainSize, [&](uint32_t chunkBegin, uint32_t chunkEnd)
+    {
+        T partial;
+        chunkFunc(chunkBegin, chunkEnd, partial);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        mergeFunc(result, partial);
+    });
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Nodes
 ///////////////////////////////////////////////////////////////////////////////
@@ -75,7 +163,20 @@ float BVH::evaluateSAH(const BVHNode& node, Math::CoordAxis axis, float splitPos
 }
 
 // axis=0 means split plane: x=value
-float BVH::computeSplitPlane(const BVHNode& node, CoordAxis* outAxis, float* outSplitPos)
+float BVH::computeSplitPlane(BuildContext& ctx, const BVHNode& node, CoordAxis* outAxis, float* outSplitPos)
+{
+    PROFILE_ZONE_IF(node.itemCount >= kProfileZoneItemCount, "BVH split plane");
+
+    switch (params.method)
+    {
+    case BVHBuildMethod_SweepSAH:   return computeSplitPlaneSweep(node, outAxis, outSplitPos);
+    case BVHBuildMethod_BinnedSAH:  return computeSplitPlaneBinned(ctx, node, outAxis, outSplitPos);
+    default:                        assert(false); return kLargeNumber;
+    }
+}
+
+// Try every item centroid as a split plane candidate, each candidate costs O(N)
+float BVH::computeSplitPlaneSweep(const BVHNode& node, CoordAxis* outAxis, float* outSplitPos)
 {
 #if 1
     CoordAxis bestAxis = CoordAxis_Count;
@@ -112,6 +213,138 @@ float BVH::computeSplitPlane(const BVHNode& node, CoordAxis* outAxis, float* out
 #endif
 }
 
+// Distribute item centroids into equally sized bins along each axis and only
+// consider the bin boundaries as split plane candidates. One pass over the items
+// fills the bins of all axes, then a prefix sweep (left) and a suffix sweep (right)
+// over the bins give the counts and bounds on both sides of every boundary.
+// https://jacco.ompf2.com/2022/04/21/how-to-build-a-bvh-part-3-quick-builds/
+float BVH::computeSplitPlaneBinned(BuildContext& ctx, const BVHNode& node, CoordAxis* outAxis, float* outSplitPos)
+{
+    struct Bin
+    {
+        Aabb bounds;
+        uint32_t itemCount = 0;
+    };
+
+    struct BinSet
+    {
+        Bin bins[CoordAxis_Count][BVHBuildParams::kMaxBinCount];
+    };
+
+    const uint32_t binCount = params.binCount;
+    assert(2 <= binCount && binCount <= BVHBuildParams::kMaxBinCount);
+
+    const uint32_t itemRefBegin = node.firstItemRef();
+    const uint32_t itemRefEnd = node.firstItemRef() + node.itemCount;
+
+    // bins are laid over the centroid bounds, not the node bounds
+    Aabb centroidBounds;
+    reduceItems(ctx.taskSystem, itemRefBegin, itemRefEnd, centroidBounds,
+        [this](uint32_t begin, uint32_t end, Aabb& bounds)
+        {
+            for (uint32_t i=begin; i<end; i++)
+                bounds.expand(getItem(i).centroid);
+        },
+        [](Aabb& bounds, const Aabb& other) { bounds.expand(other); });
+
+    float3 binScale;
+    for (uint8_t axis = 0; axis < CoordAxis_Count; axis++)
+    {
+        float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+        binScale[axis] = extent > 0.0f ? binCount / extent : 0.0f;
+    }
+
+    // populate bins
+    BinSet binSet;
+    reduceItems(ctx.taskSystem, itemRefBegin, itemRefEnd, binSet,
+        [this, &centroidBounds, &binScale, binCount](uint32_t begin, uint32_t end, BinSet& set)
+        {
+            for (uint32_t i=begin; i<end; i++)
+            {
+                const Item& item = getItem(i);
+                for (uint8_t axis = 0; axis < CoordAxis_Count; axis++)
+                {
+                    uint32_t binIndex = std::min(binCount - 1, uint32_t((item.centroid[axis] - centroidBounds.min[axis]) * binScale[axis]));
+                    Bin& bin = set.bins[axis][binIndex];
+                    bin.itemCount++;
+                    bin.bounds.expand(item.vertex0);
+                    bin.bounds.expand(item.vertex1);
+                    bin.bounds.expand(item.vertex2);
+                }
+            }
+        },
+        [binCount](BinSet& set, const BinSet& other)
+        {
+            for (uint8_t axis = 0; axis < CoordAxis_Count; axis++)
+            {
+                for (uint32_t i=0; i<binCount; i++)
+                {
+                    set.bins[axis][i].itemCount += other.bins[axis][i].itemCount;
+                    set.bins[axis][i].bounds.expand(other.bins[axis][i].bounds);
+                }
+            }
+        });
+
+    CoordAxis bestAxis = CoordAxis_Count;
+    float bestPos = 0.0f;
+    float bestCost = kLargeNumber;
+
+    for (uint8_t axisIndex = 0; axisIndex < CoordAxis_Count; axisIndex++)
+    {
+        CoordAxis axis = CoordAxis(axisIndex);
+        if (binScale[axis] == 0.0f)
+            continue;
+
+        const Bin* bins = binSet.bins[axis];
+
+        // plane i separates bins [0, i] and [i + 1, binCount - 1]
+        float leftArea[BVHBuildParams::kMaxBinCount - 1];
+        float rightArea[BVHBuildParams::kMaxBinCount - 1];
+        uint32_t leftCount[BVHBuildParams::kMaxBinCount - 1];
+        uint32_t rightCount[BVHBuildParams::kMaxBinCount - 1];
+
+        Aabb leftBox;
+        Aabb rightBox;
+        uint32_t leftSum = 0;
+        uint32_t rightSum = 0;
+        for (uint32_t i=0; i<binCount - 1; i++)
+        {
+            const Bin& leftBin = bins[i];
+            leftSum += leftBin.itemCount;
+            leftCount[i] = leftSum;
+            leftBox.expand(leftBin.bounds);
+            leftArea[i] = leftBox.area();
+
+            const Bin& rightBin = bins[binCount - 1 - i];
+            rightSum += rightBin.itemCount;
+            rightCount[binCount - 2 - i] = rightSum;
+            rightBox.expand(rightBin.bounds);
+            rightArea[binCount - 2 - i] = rightBox.area();
+        }
+
+        float boundsMin = centroidBounds.min[axis];
+        float planeWidth = (centroidBounds.max[axis] - boundsMin) / binCount;
+        for (uint32_t i=0; i<binCount - 1; i++)
+        {
+            // area of an empty box is inf and 0 * inf = nan, skip those planes
+            if (leftCount[i] == 0 || rightCount[i] == 0)
+                continue;
+
+            float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+            if (cost < bestCost)
+            {
+                bestPos = boundsMin + planeWidth * (i + 1);
+                bestAxis = axis;
+                bestCost = cost;
+            }
+        }
+    }
+
+    *outAxis = bestAxis;
+    *outSplitPos = bestPos;
+    return bestCost;
+}
+
 // Worst case number of BVHNode for N items are simply: 2N - 1 (sum the nodes of full binary tree)
 // Use geometric series to compute worst case node count (a = 1, r = 2, n = log2(N) + 1)
 // = a * (1 - r^n) / (1 - r)
@@ -129,10 +362,13 @@ static uint32_t computeMaxNodeCount(uint32_t N)
 // BVH
 ///////////////////////////////////////////////////////////////////////////////
 
-BVH::BVH(const Item* items, uint32_t _itemCount)
+BVH::BVH(const Item* items, uint32_t _itemCount, const BVHBuildParams& params, TaskSystem* taskSystem)
     : items(items)
     , itemCount(_itemCount)
+    , params(params)
 {
+    PROFILE_ZONE("BVH build");
+
     // items
     itemRefs.resize(itemCount);
     for (uint32_t i=0; i<itemCount; i++)
@@ -141,18 +377,41 @@ BVH::BVH(const Item* items, uint32_t _itemCount)
     // nodes
     uint32_t maxNodeCount = computeMaxNodeCount(itemCount);
 
-    // reserve worst case for now
-    nodePool.reserve(maxNodeCount);
+    // allocate worst case up front, so concurrent subtree builds can grab
+    // nodes with an atomic add and node references stay valid
+    nodePool.resize(maxNodeCount);
 
-    // allocate root node and assign all items to the root
-    rootNodeIndex = allocNode();
+    BuildContext ctx;
+    ctx.taskSystem = (taskSystem && taskSystem->getThreadCount() > 1) ? taskSystem : nullptr;
+    ctx.nodeCount = 0;
 
-    BVHNode& root = nodePool[rootNodeIndex];
-    root.initLeafNode(0, itemCount);
+    if (params.method == BVHBuildMethod_LBVH)
+    {
+        buildLBVH(ctx);
+    }
+    else if (params.method == BVHBuildMethod_SBVH)
+    {
+        buildSBVH(ctx);
+    }
+    else
+    {
+        // allocate root node and assign all items to the root
+        rootNodeIndex = ctx.nodeCount++;
+
+        BVHNode& root = nodePool[rootNodeIndex];
+        root.initLeafNode(0, itemCount);
+
+        updateNodeBounds(ctx, root);
 
-    updateNodeBounds(root);
+        subdivideNode(ctx, root, 0);
+    }
+
+    nodePool.resize(ctx.nodeCount);
+    nodePool.shrink_to_fit();
 
-    subdivideNode(root);
+    relayout(params.layout);
+
+    buildTriBlocks();
 
 #ifdef INTERSECTION_REORDER_NODES
     IF_PROFILING(stats.reorderNodes = true);
@@ -161,169 +420,1432 @@ BVH::BVH(const Item* items, uint32_t _itemCount)
 
 // partition items in node into two partition: partition0 and partition1.
 // returns number of item in partition0
-uint32_t BVH::partitionItems(BVHNode& node, Math::CoordAxis axis, float splitPos)
+uint32_t BVH::partitionItems(BuildContext& ctx, BVHNode& node, Math::CoordAxis axis, float splitPos)
 {
-    int i = node.firstItemRef();
-    int j = node.firstItemRef() + node.itemCount - 1;
-    while (i <= j)
+    PROFILE_ZONE_IF(node.itemCount >= kProfileZoneItemCount, "BVH partition");
+
+    if (!ctx.taskSystem || node.itemCount < kParallelItemCount)
     {
-        if (getItem(i).centroid[axis] < splitPos)
+        int i = node.firstItemRef();
+        int j = node.firstItemRef() + node.itemCount - 1;
+        while (i <= j)
         {
-            i++;
+            if (getItem(i).centroid[axis] < splitPos)
+            {
+                i++;
+            }
+            else
+            {
+                std::swap(itemRefs[i], itemRefs[j]);
+                j--;
+            }
         }
-        else
+        return (i - node.firstItemRef());
+    }
+
+    // parallel: count partition0 items per chunk, then each chunk scatters its
+    // item refs to its offsets in a scratch buffer which is copied back
+    const uint32_t firstItemRef = node.firstItemRef();
+    const uint32_t chunkCount = std::min(ctx.taskSystem->getThreadCount() * 4, (node.itemCount + kParallelGrainSize - 1) / kParallelGrainSize);
+    const uint32_t chunkSize = (node.itemCount + chunkCount - 1) / chunkCount;
+
+    auto chunkBegin = [&](uint32_t chunk) { return firstItemRef + std::min(node.itemCount, chunk * chunkSize); };
+    auto isPartition0 = [&](uint32_t i) { return getItem(i).centroid[axis] < splitPos; };
+
+    std::vector<uint32_t> chunkCount0(chunkCount);
+    ctx.taskSystem->parallelFor(0, chunkCount, 1, [&](uint32_t begin, uint32_t end)
+    {
+        for (uint32_t chunk=begin; chunk<end; chunk++)
         {
-            std::swap(itemRefs[i], itemRefs[j]);
-            j--;
+            uint32_t count0 = 0;
+            for (uint32_t i=chunkBegin(chunk); i<chunkBegin(chunk + 1); i++)
+                count0 += isPartition0(i) ? 1 : 0;
+            chunkCount0[chunk] = count0;
         }
-    }
-    return (i - node.firstItemRef());
+    });
+
+    uint32_t itemCount0 = 0;
+    for (uint32_t count0 : chunkCount0)
+        itemCount0 += count0;
+
+    std::vector<uint32_t> scratch(node.itemCount);
+    ctx.taskSystem->parallelFor(0, chunkCount, 1, [&](uint32_t begin, uint32_t end)
+    {
+        for (uint32_t chunk=begin; chunk<end; chunk++)
+        {
+            uint32_t offset0 = 0;
+            for (uint32_t c=0; c<chunk; c++)
+                offset0 += chunkCount0[c];
+            uint32_t offset1 = itemCount0 + (chunkBegin(chunk) - firstItemRef) - offset0;
+
+            for (uint32_t i=chunkBegin(chunk); i<chunkBegin(chunk + 1); i++)
+                scratch[isPartition0(i) ? offset0++ : offset1++] = itemRefs[i];
+        }
+    });
+
+    ctx.taskSystem->parallelFor(0, node.itemCount, kParallelGrainSize, [&](uint32_t begin, uint32_t end)
+    {
+        std::copy(scratch.begin() + begin, scratch.begin() + end, itemRefs.begin() + firstItemRef + begin);
+    });
+
+    return itemCount0;
 }
 
+// split items in node at the median centroid along the largest axis of the node bounds,
+// returns the number of items in partition0, half the items rounded up
+uint32_t BVH::partitionItemsMedian(BVHNode& node)
+{
+    CoordAxis axis = maxAxis(node.aabbMax - node.aabbMin);
+    uint32_t childItemCount0 = (node.itemCount + 1) / 2;
+
+    auto first = itemRefs.begin() + node.firstItemRef();
+    std::nth_element(first, first + childItemCount0, first + node.itemCount,
+        [this, axis](uint32_t a, uint32_t b) { return items[a].centroid[axis] < items[b].centroid[axis]; });
+    return childItemCount0;
+}
 
-void BVH::updateNodeBounds(BVHNode& node)
+void BVH::updateNodeBounds(BuildContext& ctx, BVHNode& node)
 {
     assert(node.itemCount > 0);
-    {
-        const Item& item = getItem(node.firstItemRef());
-        node.aabbMin = getAabbMin(item);
-        node.aabbMax = getAabbMax(item);
-    }
-    for (uint32_t i=1; i<node.itemCount; i++)
-    {
-        const Item& item = getItem(node.firstItemRef() + i);
-        node.aabbMin = min(node.aabbMin, getAabbMin(item));
-        node.aabbMax = max(node.aabbMax, getAabbMax(item));
-    }
+    PROFILE_ZONE_IF(node.itemCount >= kProfileZoneItemCount, "BVH node bounds");
+
+    Aabb bounds;
+    reduceItems(ctx.taskSystem, node.firstItemRef(), node.firstItemRef() + node.itemCount, bounds,
+        [this](uint32_t begin, uint32_t end, Aabb& chunkBounds)
+        {
+            for (uint32_t i=begin; i<end; i++)
+            {
+                const Item& item = getItem(i);
+                chunkBounds.min = min(chunkBounds.min, getAabbMin(item));
+                chunkBounds.max = max(chunkBounds.max, getAabbMax(item));
+            }
+        },
+        [](Aabb& bounds, const Aabb& other) { bounds.expand(other); });
+
+    node.aabbMin = bounds.min;
+    node.aabbMax = bounds.max;
 }
 
 // subdivide
-void BVH::subdivideNode(BVHNode& node)
+void BVH::subdivideNode(BuildContext& ctx, BVHNode& node, uint32_t depth)
 {
     //if (node.itemCount <= 2)
     //    return;
 
-    CoordAxis splitAxis;
-    float splitPos;
-    float splitCost = computeSplitPlane(node, &splitAxis, &splitPos);
+    uint32_t childItemCount0;
 
-    // if splitting doesn't improve, no need to subdivide
-    Aabb nodeAabb(node.aabbMin, node.aabbMax);
-    float nodeCost = node.itemCount * nodeAabb.area();    
-    if (splitCost >= nodeCost)
-        return;
+    // degenerate inputs can chain SAH splits deeper than the traversal stacks, median splits
+    // take a level off the ceil(log2(itemCount)) levels below, so switch once those are needed
+    if (depth + std::bit_width(node.itemCount - 1) >= kMaxDepth)
+    {
+        if (node.itemCount == 1)
+            return;
 
-    uint32_t childItemCount0 = partitionItems(node, splitAxis, splitPos);
-    
-    // we don't need to subdivide if any of the partitions is empty
-    if (childItemCount0 == 0 || childItemCount0 == node.itemCount)
-        return;
+        childItemCount0 = partitionItemsMedian(node);
+    }
+    else
+    {
+        CoordAxis splitAxis;
+        float splitPos;
+        float splitCost = computeSplitPlane(ctx, node, &splitAxis, &splitPos);
+
+        // if splitting doesn't improve, no need to subdivide
+        Aabb nodeAabb(node.aabbMin, node.aabbMax);
+        float nodeCost = node.itemCount * nodeAabb.area();
+        if (splitCost >= nodeCost)
+            return;
+
+        childItemCount0 = partitionItems(ctx, node, splitAxis, splitPos);
+
+        // we don't need to subdivide if any of the partitions is empty
+        if (childItemCount0 == 0 || childItemCount0 == node.itemCount)
+            return;
+    }
 
     assert(node.isLeaf());
 
-    // create child nodes
-    uint32_t childIndex0 = allocNode();
+    // create child nodes, siblings are allocated together so they stay adjacent
+    uint32_t childIndex0 = allocNodePair(ctx);
+    uint32_t childIndex1 = childIndex0 + 1;
+    assert(childIndex1 < nodePool.size());
+
     BVHNode& child0 = nodePool[childIndex0];
     child0.initLeafNode(node.firstItemRef(), childItemCount0);
-    updateNodeBounds(child0);
+    updateNodeBounds(ctx, child0);
 
-    uint32_t childIndex1 = allocNode();
     BVHNode& child1 = nodePool[childIndex1];
     child1.initLeafNode(node.firstItemRef() + childItemCount0, node.itemCount - childItemCount0);
-    updateNodeBounds(child1);
+    updateNodeBounds(ctx, child1);
 
     // update current node
-    assert(childIndex1 == childIndex0 + 1);
+    bool parallel = ctx.taskSystem && node.itemCount >= kParallelSubtreeItemCount;
     node.initInternalNode(childIndex0);
 
-    subdivideNode(child0);
-    subdivideNode(child1);
+    if (parallel)
+    {
+        // child subtrees touch disjoint item ref ranges and nodes
+        TaskGroup group;
+        ctx.taskSystem->submit(group, [this, &ctx, &child0, depth]() { subdivideNode(ctx, child0, depth + 1); });
+        subdivideNode(ctx, child1, depth + 1);
+        ctx.taskSystem->wait(group);
+    }
+    else
+    {
+        subdivideNode(ctx, child0, depth + 1);
+        subdivideNode(ctx, child1, depth + 1);
+    }
 }
 
-void BVH::intersect(Math::Ray& ray, BVHNode& node)
+///////////////////////////////////////////////////////////////////////////////
+// LBVH
+///////////////////////////////////////////////////////////////////////////////
+
+// Linear BVH: sort items along a Morton curve, then split every node where the
+// highest bit of the Morton codes in its range changes.
+// https://research.nvidia.com/publication/2012-06_maximizing-parallelism-construction-bvhs-octrees-and-k-d-trees
+void BVH::buildLBVH(BuildContext& ctx)
 {
-    IF_PROFILING(stats.intersectRayAabbCount++);
-    if (intersectRayAabb(ray, node.aabbMin, node.aabbMax) == Ray::kInf)
-        return;
+    assert(params.mortonBits == 30 || params.mortonBits == 63);
 
-    if (node.isLeaf())
+    // normalize centroids to their bounds
+    Aabb centroidBounds;
+    reduceItems(ctx.taskSystem, 0, itemCount, centroidBounds,
+        [this](uint32_t begin, uint32_t end, Aabb& bounds)
+        {
+            for (uint32_t i=begin; i<end; i++)
+                bounds.expand(items[i].centroid);
+        },
+        [](Aabb& bounds, const Aabb& other) { bounds.expand(other); });
+
+    float3 extent = centroidBounds.extent();
+    float3 scale;
+    for (uint8_t axis = 0; axis < CoordAxis_Count; axis++)
+        scale[axis] = extent[axis] > 0.0f ? 1.0f / extent[axis] : 0.0f;
+
+    std::vector<uint64_t> mortonCodes(itemCount);
+    auto computeMortonCodes = [&](uint32_t begin, uint32_t end)
     {
-        for (uint32_t i=0; i<node.itemCount; i++)
+        for (uint32_t i=begin; i<end; i++)
         {
-            const Item& item = getItem(node.firstItemRef() + i);
-            intersectRayTri(ray, item);
+            float3 p = (items[i].centroid - centroidBounds.min) * scale;
+            mortonCodes[i] = (params.mortonBits == 30) ? morton30(p) : morton63(p);
         }
-        IF_PROFILING(stats.intersectRayTriCount += node.itemCount);
+    };
+    {
+        PROFILE_ZONE("LBVH morton codes");
+        if (ctx.taskSystem)
+            ctx.taskSystem->parallelFor(0, itemCount, kParallelGrainSize, computeMortonCodes);
+        else
+            computeMortonCodes(0, itemCount);
     }
-    else
+
+    // item refs follow the Morton order
     {
-        static_assert(BVHNode::kChildCount == 2);
-        intersect(ray, nodePool[node.firstChild()]);
-        intersect(ray, nodePool[node.firstChild() + 1]);
-    } 
+        PROFILE_ZONE("LBVH radix sort");
+        RadixSort(mortonCodes, itemRefs, params.mortonBits);
+    }
+
+    rootNodeIndex = ctx.nodeCount++;
+
+    BVHNode& root = nodePool[rootNodeIndex];
+    root.initLeafNode(0, itemCount);
+
+    PROFILE_ZONE("LBVH emit nodes");
+    emitLBVHNode(ctx, mortonCodes.data(), root, 0);
 }
 
-void BVH::intersect(Math::Ray& ray)
+// node covers a range of sorted item refs, split it and compute bounds bottom-up
+void BVH::emitLBVHNode(BuildContext& ctx, const uint64_t* mortonCodes, BVHNode& node, uint32_t depth)
 {
-#ifdef INTERSECTION_REORDER_NODES
-    BVHNode* node = &nodePool[rootNodeIndex];
+    const uint32_t first = node.firstItemRef();
+    const uint32_t last = node.firstItemRef() + node.itemCount - 1;
 
-    // check if we hit root node aabb at all
-    IF_PROFILING(stats.intersectRayAabbCount++);
-    if (intersectRayAabb(ray, node->aabbMin, node->aabbMax) == Ray::kInf)
+    if (node.itemCount == 1)
+    {
+        const Item& item = getItem(first);
+        node.aabbMin = getAabbMin(item);
+        node.aabbMax = getAabbMax(item);
         return;
+    }
 
-    BVHNode* stack[64];
-    uint32_t stackPtr = 0;
-
-    while (1)
+    // split where the highest differing bit flips, identical codes are split in the middle.
+    // Nodes switch to middle splits too once these are needed to stay within kMaxDepth levels,
+    // each one takes a level off the ceil(log2(itemCount)) levels below.
+    uint32_t split;
+    uint64_t firstCode = mortonCodes[first];
+    uint64_t lastCode = mortonCodes[last];
+    if (firstCode == lastCode || depth + std::bit_width(node.itemCount - 1) >= kMaxDepth)
     {
-        if (node->isLeaf())
-        {
-            for (uint32_t i=0; i<node->itemCount; i++)
-            {
-                const Item& item = getItem(node->firstItemRef() + i);
-                intersectRayTri(ray, item);
-            }
-            IF_PROFILING(stats.intersectRayTriCount += node->itemCount);
-            
-            if (stackPtr == 0)
-                break;
+        split = (first + last) >> 1;
+    }
+    else
+    {
+        uint64_t highestBit = uint64_t(1) << (63 - std::countl_zero(firstCode ^ lastCode));
 
-            node = stack[--stackPtr];
-        }
-        else
+        // binary search for the last code sharing the prefix with firstCode
+        split = first;
+        uint32_t step = last - first;
+        do
         {
-            // we want to traverse front front-to-back
-            static_assert(BVHNode::kChildCount == 2);
-            BVHNode* child0 = &nodePool[node->firstChild()];
-            BVHNode* child1 = &nodePool[node->firstChild() + 1];
+            step = (step + 1) >> 1;
+            uint32_t candidate = split + step;
+            if (candidate < last && (mortonCodes[candidate] & highestBit) == (firstCode & highestBit))
+                split = candidate;
+        }
+        while (step > 1);
+    }
 
-            float dist0 = intersectRayAabb(ray, child0->aabbMin, child0->aabbMax);
-            float dist1 = intersectRayAabb(ray, child1->aabbMin, child1->aabbMax);
-            IF_PROFILING(stats.intersectRayAabbCount += 2);
+    uint32_t childItemCount0 = split - first + 1;
 
-            if (dist0 > dist1)
-            {
-                std::swap(dist0, dist1);
-                std::swap(child0, child1);
-            }
+    uint32_t childIndex0 = allocNodePair(ctx);
+    uint32_t childIndex1 = childIndex0 + 1;
+    assert(childIndex1 < nodePool.size());
 
-            // at this point child0 is the front, child1 is the back
-            if (dist0 == Ray::kInf)
-            {
-                if (stackPtr == 0)
-                    break;
-                node = stack[--stackPtr];
-            }
-            else
+    BVHNode& child0 = nodePool[childIndex0];
+    child0.initLeafNode(first, childItemCount0);
+
+    BVHNode& child1 = nodePool[childIndex1];
+    child1.initLeafNode(first + childItemCount0, node.itemCount - childItemCount0);
+
+    bool parallel = ctx.taskSystem && node.itemCount >= kParallelSubtreeItemCount;
+    node.initInternalNode(childIndex0);
+
+    if (parallel)
+    {
+        TaskGroup group;
+        ctx.taskSystem->submit(group, [this, &ctx, mortonCodes, &child0, depth]() { emitLBVHNode(ctx, mortonCodes, child0, depth + 1); });
+        emitLBVHNode(ctx, mortonCodes, child1, depth + 1);
+        ctx.taskSystem->wait(group);
+    }
+    else
+    {
+        emitLBVHNode(ctx, mortonCodes, child0, depth + 1);
+        emitLBVHNode(ctx, mortonCodes, child1, depth + 1);
+    }
+
+    node.aabbMin = min(child0.aabbMin, child1.aabbMin);
+    node.aabbMax = max(child0.aabbMax, child1.aabbMax);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// SBVH
+///////////////////////////////////////////////////////////////////////////////
+
+// Stich et al. 2009, Spatial Splits in Bounding Volume Hierarchies
+// https://www.nvidia.com/docs/IO/77714/sbvh.pdf
+
+// an item, or the part of it left to one side of the spatial splits above
+struct BVH::SpatialRef
+{
+    Aabb bounds;
+    uint32_t itemIndex;
+};
+
+static bool isEmpty(const Aabb& aabb)
+{
+    return aabb.min.x > aabb.max.x || aabb.min.y > aabb.max.y || aabb.min.z > aabb.max.z;
+}
+
+static Aabb intersection(const Aabb& a, const Aabb& b)
+{
+    return Aabb(max(a.min, b.min), min(a.max, b.max));
+}
+
+// bounds of the part of the triangle in the slab [slabMin, slabMax] along axis,
+// empty if the triangle is outside
+static Aabb clipTriBounds(const BVH::Item& tri, CoordAxis axis, float slabMin, float slabMax)
+{
+    const float3* vertices[3] = { &tri.vertex0, &tri.vertex1, &tri.vertex2 };
+
+    Aabb bounds;
+    for (uint32_t i=0; i<3; i++)
+    {
+        const float3& a = *vertices[i];
+        const float3& b = *vertices[(i + 1) % 3];
+        if (a[axis] >= slabMin && a[axis] <= slabMax)
+            bounds.expand(a);
+
+        // edge crossings of both slab planes, snapped onto the plane
+        for (float plane : { slabMin, slabMax })
+        {
+            if ((a[axis] < plane && b[axis] > plane) || (a[axis] > plane && b[axis] < plane))
             {
-                node = child0;
-                if (dist1 != Ray::kInf) stack[stackPtr++] = child1;
+                float3 p = a + (b - a) * ((plane - a[axis]) / (b[axis] - a[axis]));
+                p[axis] = plane;
+                bounds.expand(p);
             }
         }
     }
-#else
-    intersect(ray, nodePool[rootNodeIndex]);
-#endif
+    return bounds;
 }
+
+void BVH::buildSBVH(BuildContext& ctx)
+{
+    std::vector<SpatialRef> refs(itemCount);
+    Aabb rootBounds;
+    for (uint32_t i=0; i<itemCount; i++)
+    {
+        refs[i].bounds = Aabb(getAabbMin(items[i]), getAabbMax(items[i]));
+        refs[i].itemIndex = i;
+        rootBounds.expand(refs[i].bounds);
+    }
+
+    // leaves append their refs, duplicates included
+    itemRefs.clear();
+
+    rootNodeIndex = ctx.nodeCount++;
+    BVHNode& root = nodePool[rootNodeIndex];
+    root.aabbMin = rootBounds.min;
+    root.aabbMax = rootBounds.max;
+
+    subdivideSBVHNode(ctx, rootNodeIndex, refs, rootBounds.area(), 0);
+}
+
+// Picks the cheapest of the best object split (binned over the ref centroids)
+// and, when the children of that split overlap, the best spatial split (binned
+// over the node bounds, refs are clipped into every bin they cross). Straddling
+// refs of a spatial split are duplicated unless moving them whole to one side
+// is cheaper.
+void BVH::subdivideSBVHNode(BuildContext& ctx, uint32_t nodeIndex, std::vector<SpatialRef>& refs, float rootArea, uint32_t depth)
+{
+    struct Bin
+    {
+        Aabb bounds;
+        uint32_t entryCount = 0;    // refs starting in the bin, the only count of object bins
+        uint32_t exitCount = 0;     // refs ending in the bin, spatial bins only
+    };
+
+    const uint32_t binCount = params.binCount;
+    assert(2 <= binCount && binCount <= BVHBuildParams::kMaxBinCount);
+
+    const uint32_t refCount = uint32_t(refs.size());
+    const Aabb nodeBounds(nodePool[nodeIndex].aabbMin, nodePool[nodeIndex].aabbMax);
+    const float leafCost = refCount * nodeBounds.area();
+
+    // object split
+    Aabb centroidBounds;
+    for (const SpatialRef& ref : refs)
+        centroidBounds.expand((ref.bounds.min + ref.bounds.max) * 0.5f);
+
+    float3 objectBinScale;
+    for (uint8_t axis = 0; axis < CoordAxis_Count; axis++)
+    {
+        float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+        objectBinScale[axis] = extent > 0.0f ? binCount / extent : 0.0f;
+    }
+    auto getObjectBin = [&](const SpatialRef& ref, CoordAxis axis)
+    {
+        float centroid = (ref.bounds.min[axis] + ref.bounds.max[axis]) * 0.5f;
+        return std::min(binCount - 1, uint32_t((centroid - centroidBounds.min[axis]) * objectBinScale[axis]));
+    };
+
+    CoordAxis objectAxis = CoordAxis_Count;
+    uint32_t objectSplit = 0;       // first bin of the right side
+    float objectCost = kLargeNumber;
+    Aabb objectLeftBounds;
+    Aabb objectRightBounds;
+    for (uint8_t axisIndex = 0; axisIndex < CoordAxis_Count; axisIndex++)
+    {
+        CoordAxis axis = CoordAxis(axisIndex);
+        if (objectBinScale[axis] == 0.0f)
+            continue;
+
+        Bin bins[BVHBuildParams::kMaxBinCount];
+        for (const SpatialRef& ref : refs)
+        {
+            Bin& bin = bins[getObjectBin(ref, axis)];
+            bin.entryCount++;
+            bin.bounds.expand(ref.bounds);
+        }
+
+        Aabb leftBounds[BVHBuildParams::kMaxBinCount];
+        uint32_t leftCount[BVHBuildParams::kMaxBinCount];
+        Aabb leftBox;
+        uint32_t leftSum = 0;
+        for (uint32_t i=0; i<binCount - 1; i++)
+        {
+            leftSum += bins[i].entryCount;
+            leftBox.expand(bins[i].bounds);
+            leftCount[i] = leftSum;
+            leftBounds[i] = leftBox;
+        }
+
+        Aabb rightBox;
+        uint32_t rightSum = 0;
+        for (uint32_t i=binCount - 1; i>0; i--)
+        {
+            rightSum += bins[i].entryCount;
+            rightBox.expand(bins[i].bounds);
+            if (leftCount[i - 1] == 0 || rightSum == 0)
+                continue;
+
+            float cost = leftCount[i - 1] * leftBounds[i - 1].area() + rightSum * rightBox.area();
+            if (cost < objectCost)
+            {
+                objectCost = cost;
+                objectAxis = axis;
+                objectSplit = i;
+                objectLeftBounds = leftBounds[i - 1];
+                objectRightBounds = rightBox;
+            }
+        }
+    }
+
+    // spatial split, only where the object split leaves overlapping children
+    CoordAxis spatialAxis = CoordAxis_Count;
+    float spatialPos = 0.0f;
+    float spatialCost = kLargeNumber;
+    Aabb spatialLeftBounds;
+    Aabb spatialRightBounds;
+    uint32_t spatialLeftCount = 0;
+    uint32_t spatialRightCount = 0;
+
+    Aabb overlap = intersection(objectLeftBounds, objectRightBounds);
+    bool searchSpatial = objectAxis == CoordAxis_Count
+        || (!isEmpty(overlap) && overlap.area() > params.splitOverlapThreshold * rootArea);
+    for (uint8_t axisIndex = 0; searchSpatial && axisIndex < CoordAxis_Count; axisIndex++)
+    {
+        CoordAxis axis = CoordAxis(axisIndex);
+        float boundsMin = nodeBounds.min[axis];
+        float binWidth = (nodeBounds.max[axis] - boundsMin) / binCount;
+        if (binWidth <= 0.0f)
+            continue;
+
+        auto getSpatialBin = [&](float pos) { return std::min(binCount - 1, uint32_t(std::max(0.0f, (pos - boundsMin) / binWidth))); };
+
+        Bin bins[BVHBuildParams::kMaxBinCount];
+        for (const SpatialRef& ref : refs)
+        {
+            uint32_t firstBin = getSpatialBin(ref.bounds.min[axis]);
+            uint32_t lastBin = getSpatialBin(ref.bounds.max[axis]);
+            bins[firstBin].entryCount++;
+            bins[lastBin].exitCount++;
+
+            if (firstBin == lastBin)
+            {
+                bins[firstBin].bounds.expand(ref.bounds);
+                continue;
+            }
+
+            const Item& item = items[ref.itemIndex];
+            for (uint32_t i=firstBin; i<=lastBin; i++)
+            {
+                Aabb clipped = intersection(clipTriBounds(item, axis, boundsMin + binWidth * i, boundsMin + binWidth * (i + 1)), ref.bounds);
+                if (!isEmpty(clipped))
+                    bins[i].bounds.expand(clipped);
+            }
+        }
+
+        Aabb leftBounds[BVHBuildParams::kMaxBinCount];
+        uint32_t leftCount[BVHBuildParams::kMaxBinCount];
+        Aabb leftBox;
+        uint32_t leftSum = 0;
+        for (uint32_t i=0; i<binCount - 1; i++)
+        {
+            leftSum += bins[i].entryCount;
+            leftBox.expand(bins[i].bounds);
+            leftCount[i] = leftSum;
+            leftBounds[i] = leftBox;
+        }
+
+        Aabb rightBox;
+        uint32_t rightSum = 0;
+        for (uint32_t i=binCount - 1; i>0; i--)
+        {
+            rightSum += bins[i].exitCount;
+            rightBox.expand(bins[i].bounds);
+            if (leftCount[i - 1] == 0 || rightSum == 0)
+                continue;
+
+            float cost = leftCount[i - 1] * leftBounds[i - 1].area() + rightSum * rightBox.area();
+            if (cost < spatialCost)
+            {
+                spatialCost = cost;
+                spatialAxis = axis;
+                spatialPos = boundsMin + binWidth * i;
+                spatialLeftBounds = leftBounds[i - 1];
+                spatialRightBounds = rightBox;
+                spatialLeftCount = leftCount[i - 1];
+                spatialRightCount = rightSum;
+            }
+        }
+    }
+
+    std::vector<SpatialRef> leftRefs;
+    std::vector<SpatialRef> rightRefs;
+    bool isLeaf = refCount == 1 || depth + 1 >= kMaxDepth || std::min(objectCost, spatialCost) >= leafCost;
+    if (!isLeaf && spatialCost < objectCost)
+    {
+        const CoordAxis axis = spatialAxis;
+        const float leftArea = spatialLeftBounds.area();
+        const float rightArea = spatialRightBounds.area();
+        for (const SpatialRef& ref : refs)
+        {
+            if (ref.bounds.max[axis] <= spatialPos)
+            {
+                leftRefs.push_back(ref);
+                continue;
+            }
+            if (ref.bounds.min[axis] >= spatialPos)
+            {
+                rightRefs.push_back(ref);
+                continue;
+            }
+
+            // unsplit when a whole ref on one side costs less than the duplicate
+            float splitCost = leftArea * spatialLeftCount + rightArea * spatialRightCount;
+            float leftOnlyCost = Aabb(spatialLeftBounds).expand(ref.bounds).area() * spatialLeftCount + rightArea * (spatialRightCount - 1);
+            float rightOnlyCost = leftArea * (spatialLeftCount - 1) + Aabb(spatialRightBounds).expand(ref.bounds).area() * spatialRightCount;
+
+            const Item& item = items[ref.itemIndex];
+            Aabb leftPart = intersection(clipTriBounds(item, axis, -kLargeNumber, spatialPos), ref.bounds);
+            Aabb rightPart = intersection(clipTriBounds(item, axis, spatialPos, kLargeNumber), ref.bounds);
+
+            if (leftOnlyCost < splitCost && leftOnlyCost <= rightOnlyCost)
+            {
+                leftRefs.push_back(ref);
+            }
+            else if (rightOnlyCost < splitCost || isEmpty(leftPart))
+            {
+                rightRefs.push_back(ref);
+            }
+            else if (isEmpty(rightPart))
+            {
+                leftRefs.push_back(ref);
+            }
+            else
+            {
+                leftRefs.push_back({ leftPart, ref.itemIndex });
+                rightRefs.push_back({ rightPart, ref.itemIndex });
+            }
+        }
+    }
+    else if (!isLeaf)
+    {
+        for (const SpatialRef& ref : refs)
+            (getObjectBin(ref, objectAxis) < objectSplit ? leftRefs : rightRefs).push_back(ref);
+    }
+
+    if (isLeaf || leftRefs.empty() || rightRefs.empty())
+    {
+        nodePool[nodeIndex].initLeafNode(uint32_t(itemRefs.size()), refCount);
+        for (const SpatialRef& ref : refs)
+            itemRefs.push_back(ref.itemIndex);
+        return;
+    }
+
+    // the children hold the refs from here on
+    std::vector<SpatialRef>().swap(refs);
+
+    // the ref count isn't known up front, the pool grows and nodes are addressed by index
+    uint32_t childIndex0 = ctx.nodeCount;
+    ctx.nodeCount += 2;
+    if (ctx.nodeCount > nodePool.size())
+        nodePool.resize(nodePool.size() * 2);
+
+    for (uint32_t i=0; i<2; i++)
+    {
+        const std::vector<SpatialRef>& childRefs = i == 0 ? leftRefs : rightRefs;
+        Aabb childBounds;
+        for (const SpatialRef& ref : childRefs)
+            childBounds.expand(ref.bounds);
+        nodePool[childIndex0 + i].aabbMin = childBounds.min;
+        nodePool[childIndex0 + i].aabbMax = childBounds.max;
+    }
+    nodePool[nodeIndex].initInternalNode(childIndex0);
+
+    subdivideSBVHNode(ctx, childIndex0, leftRefs, rootArea, depth + 1);
+    subdivideSBVHNode(ctx, childIndex0 + 1, rightRefs, rootArea, depth + 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Node layout
+///////////////////////////////////////////////////////////////////////////////
+
+// Layouts order sibling pairs, identified by the index of their first node.
+// 64 pairs of 32-byte nodes fill a 4 KB page.
+static constexpr uint32_t kTreeletPairCount = 4096 / (2 * sizeof(BVHNode));
+
+// child pairs of the pair at index pair, in child order
+static uint32_t getChildPairs(const BVH::NodePool& nodes, uint32_t pair, uint32_t* outChildPairs)
+{
+    uint32_t childPairCount = 0;
+    for (uint32_t i=0; i<2; i++)
+    {
+        if (!nodes[pair + i].isLeaf())
+            outChildPairs[childPairCount++] = nodes[pair + i].firstChild();
+    }
+    return childPairCount;
+}
+
+static void orderPairsDepthFirst(const BVH::NodePool& nodes, uint32_t rootPair, std::vector<uint32_t>& order)
+{
+    std::vector<uint32_t> stack = { rootPair };
+    while (!stack.empty())
+    {
+        uint32_t pair = stack.back();
+        stack.pop_back();
+        order.push_back(pair);
+
+        // pushed in reverse so the left child's pair comes next
+        uint32_t childPairs[2];
+        uint32_t childPairCount = getChildPairs(nodes, pair, childPairs);
+        for (uint32_t i=childPairCount; i-- > 0; )
+            stack.push_back(childPairs[i]);
+    }
+}
+
+// levels of pairs below and including pair
+static uint32_t computePairHeight(const BVH::NodePool& nodes, uint32_t pair)
+{
+    uint32_t childPairs[2];
+    uint32_t childPairCount = getChildPairs(nodes, pair, childPairs);
+
+    uint32_t height = 0;
+    for (uint32_t i=0; i<childPairCount; i++)
+        height = std::max(height, computePairHeight(nodes, childPairs[i]));
+    return height + 1;
+}
+
+static void collectPairsAtDepth(const BVH::NodePool& nodes, uint32_t pair, uint32_t depth, std::vector<uint32_t>& outPairs)
+{
+    if (depth == 0)
+    {
+        outPairs.push_back(pair);
+        return;
+    }
+
+    uint32_t childPairs[2];
+    uint32_t childPairCount = getChildPairs(nodes, pair, childPairs);
+    for (uint32_t i=0; i<childPairCount; i++)
+        collectPairsAtDepth(nodes, childPairs[i], depth - 1, outPairs);
+}
+
+// Lays out the top height levels below pair: the upper half recursively, then
+// every subtree hanging below it recursively. Subtrees of any size end up in
+// few consecutive blocks, whatever the cache line or page size.
+static void orderPairsVanEmdeBoas(const BVH::NodePool& nodes, uint32_t pair, uint32_t height, std::vector<uint32_t>& order)
+{
+    if (height == 1)
+    {
+        order.push_back(pair);
+        return;
+    }
+
+    uint32_t topHeight = height / 2;
+    orderPairsVanEmdeBoas(nodes, pair, topHeight, order);
+
+    std::vector<uint32_t> bottomPairs;
+    collectPairsAtDepth(nodes, pair, topHeight, bottomPairs);
+    for (uint32_t bottomPair : bottomPairs)
+        orderPairsVanEmdeBoas(nodes, bottomPair, height - topHeight, order);
+}
+
+// Each treelet grows from its root pair by the pair with the largest area, the
+// likeliest to be visited, until it fills a page. The pairs left at its border
+// root the next treelets.
+static void orderPairsTreelets(const BVH::NodePool& nodes, uint32_t rootPair, std::vector<uint32_t>& order)
+{
+    auto getPairArea = [&nodes](uint32_t pair)
+    {
+        return Aabb(nodes[pair].aabbMin, nodes[pair].aabbMax).expand(Aabb(nodes[pair + 1].aabbMin, nodes[pair + 1].aabbMax)).area();
+    };
+
+    struct Candidate
+    {
+        float area;
+        uint32_t pair;
+        bool operator<(const Candidate& other) const { return area < other.area; }
+    };
+
+    std::vector<uint32_t> treeletRoots = { rootPair };
+    for (size_t treelet = 0; treelet < treeletRoots.size(); treelet++)
+    {
+        std::priority_queue<Candidate> candidates;
+        candidates.push({ getPairArea(treeletRoots[treelet]), treeletRoots[treelet] });
+
+        for (uint32_t i=0; i<kTreeletPairCount && !candidates.empty(); i++)
+        {
+            uint32_t pair = candidates.top().pair;
+            candidates.pop();
+            order.push_back(pair);
+
+            uint32_t childPairs[2];
+            uint32_t childPairCount = getChildPairs(nodes, pair, childPairs);
+            for (uint32_t c=0; c<childPairCount; c++)
+                candidates.push({ getPairArea(childPairs[c]), childPairs[c] });
+        }
+
+        for (; !candidates.empty(); candidates.pop())
+            treeletRoots.push_back(candidates.top().pair);
+    }
+}
+
+void BVH::relayout(BVHNodeLayout layout)
+{
+    PROFILE_ZONE("BVH relayout");
+
+    params.layout = layout;
+
+    const BVHNode& root = nodePool[rootNodeIndex];
+    if (layout == BVHNodeLayout_Build || root.isLeaf())
+        return;
+
+    std::vector<uint32_t> pairOrder;
+    pairOrder.reserve(nodePool.size() / 2);
+    switch (layout)
+    {
+    case BVHNodeLayout_DepthFirst:  orderPairsDepthFirst(nodePool, root.firstChild(), pairOrder); break;
+    case BVHNodeLayout_VanEmdeBoas: orderPairsVanEmdeBoas(nodePool, root.firstChild(), computePairHeight(nodePool, root.firstChild()), pairOrder); break;
+    case BVHNodeLayout_Treelets:    orderPairsTreelets(nodePool, root.firstChild(), pairOrder); break;
+    default:                        assert(false); return;
+    }
+
+    // pairs at even indices share a cache line, the root goes after them
+    const uint32_t pairCount = uint32_t(pairOrder.size());
+    std::vector<uint32_t> newIndices(nodePool.size());
+    for (uint32_t i=0; i<pairCount; i++)
+    {
+        newIndices[pairOrder[i]] = 2 * i;
+        newIndices[pairOrder[i] + 1] = 2 * i + 1;
+    }
+    newIndices[rootNodeIndex] = 2 * pairCount;
+
+    NodePool newPool(2 * pairCount + 1);
+    for (uint32_t i=0; i<nodePool.size(); i++)
+    {
+        BVHNode node = nodePool[i];
+        if (!node.isLeaf())
+            node.initInternalNode(newIndices[node.firstChild()]);
+        newPool[newIndices[i]] = node;
+    }
+
+    assert(newPool.size() == nodePool.size());
+    nodePool.swap(newPool);
+    rootNodeIndex = 2 * pairCount;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Refit
+///////////////////////////////////////////////////////////////////////////////
+
+void BVH::refit(TaskSystem* taskSystem)
+{
+    PROFILE_ZONE("BVH refit");
+
+    const uint32_t nodeCount = uint32_t(nodePool.size());
+
+    // leaves, each reads its own items
+    auto refitLeaves = [this](uint32_t begin, uint32_t end)
+    {
+        BuildContext ctx;
+        ctx.taskSystem = nullptr;
+        for (uint32_t i=begin; i<end; i++)
+        {
+            if (nodePool[i].isLeaf())
+                updateNodeBounds(ctx, nodePool[i]);
+        }
+    };
+    if (taskSystem && taskSystem->getThreadCount() > 1)
+        taskSystem->parallelFor(0, nodeCount, kParallelGrainSize, refitLeaves);
+    else
+        refitLeaves(0, nodeCount);
+
+    // Children follow their parent in the build order and in every layout, so a
+    // reverse pass reaches them first. Only relayout() moves the root behind them,
+    // load() rejects files breaking the order.
+    auto refitInternalNode = [this](BVHNode& node)
+    {
+        const BVHNode& child0 = nodePool[node.firstChild()];
+        const BVHNode& child1 = nodePool[node.firstChild() + 1];
+        node.aabbMin = min(child0.aabbMin, child1.aabbMin);
+        node.aabbMax = max(child0.aabbMax, child1.aabbMax);
+    };
+    for (uint32_t i=nodeCount; i-- > 0; )
+    {
+        if (i == rootNodeIndex || nodePool[i].isLeaf())
+            continue;
+
+        assert(nodePool[i].firstChild() > i);
+        refitInternalNode(nodePool[i]);
+    }
+    if (!nodePool[rootNodeIndex].isLeaf())
+        refitInternalNode(nodePool[rootNodeIndex]);
+
+    buildTriBlocks();
+}
+
+float BVH::computeSAHCost() const
+{
+    const BVHNode& root = nodePool[rootNodeIndex];
+    float rootArea = Aabb(root.aabbMin, root.aabbMax).area();
+
+    // summed in double, the pool can hold millions of nodes
+    double cost = 0.0;
+    for (const BVHNode& node : nodePool)
+    {
+        float area = Aabb(node.aabbMin, node.aabbMax).area();
+        cost += node.isLeaf() ? kSAHItemCost * node.itemCount * area : kSAHNodeCost * area;
+    }
+    return float(cost / rootArea);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Serialization
+///////////////////////////////////////////////////////////////////////////////
+
+// File layout: header, BVHNode[nodeCount] at nodeOffset, uint32_t[itemRefCount] at itemRefOffset
+struct BVHFileHeader
+{
+    static constexpr uint32_t kMagic = 'B' | 'V' << 8 | 'H' << 16 | '2' << 24;
+    static constexpr uint32_t kVersion = 3;
+
+    uint32_t magic;
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t nodeSize;
+    uint32_t method;
+    uint32_t binCount;
+    uint32_t mortonBits;
+    uint32_t itemCount;
+    uint32_t itemRefCount;          // more than itemCount after spatial splits
+    uint32_t nodeCount;
+    uint32_t rootNodeIndex;
+    float splitOverlapThreshold;
+    uint32_t layout;
+    uint32_t padding;               // keeps the 64-bit fields aligned
+    uint64_t contentHash;
+    uint64_t nodeOffset;
+    uint64_t itemRefOffset;
+};
+
+uint64_t BVH::computeContentHash(const Item* items, uint32_t itemCount)
+{
+    // FNV-1a over 64-bit words rather than bytes, scenes are large
+    static_assert(sizeof(Item) % sizeof(uint64_t) == 0);
+    const uint64_t kPrime = 0x100000001b3ull;
+
+    uint64_t hash = 0xcbf29ce484222325ull;
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(items);
+    size_t wordCount = size_t(itemCount) * sizeof(Item) / sizeof(uint64_t);
+    for (size_t i=0; i<wordCount; i++)
+    {
+        uint64_t word;
+        memcpy(&word, data + i * sizeof(uint64_t), sizeof(word));
+        hash = (hash ^ word) * kPrime;
+    }
+    return (hash ^ itemCount) * kPrime;
+}
+
+bool BVH::save(const char* filepath) const
+{
+    PROFILE_ZONE("BVH save");
+
+    BVHFileHeader header = {};
+    header.magic = BVHFileHeader::kMagic;
+    header.version = BVHFileHeader::kVersion;
+    header.headerSize = sizeof(BVHFileHeader);
+    header.nodeSize = sizeof(BVHNode);
+    header.method = params.method;
+    header.binCount = params.binCount;
+    header.mortonBits = params.mortonBits;
+    header.itemCount = itemCount;
+    header.itemRefCount = uint32_t(itemRefs.size());
+    header.splitOverlapThreshold = params.splitOverlapThreshold;
+    header.layout = params.layout;
+    header.nodeCount = uint32_t(nodePool.size());
+    header.rootNodeIndex = rootNodeIndex;
+    header.contentHash = computeContentHash(items, itemCount);
+    header.nodeOffset = sizeof(BVHFileHeader);
+    header.itemRefOffset = header.nodeOffset + nodePool.size() * sizeof(BVHNode);
+
+    FILE* file = fopen(filepath, "wb");
+    if (!file)
+        return false;
+
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(nodePool.data(), sizeof(BVHNode), nodePool.size(), file) == nodePool.size()
+        && fwrite(itemRefs.data(), sizeof(uint32_t), itemRefs.size(), file) == itemRefs.size();
+
+    return fclose(file) == 0 && written;
+}
+
+std::optional<BVH> BVH::load(const char* filepath, const Item* items, uint32_t itemCount, const BVHBuildParams& params)
+{
+    PROFILE_ZONE("BVH load");
+
+    MappedFile file;
+    if (!file.open(filepath) || file.getSize() < sizeof(BVHFileHeader))
+        return std::nullopt;
+
+    BVHFileHeader header;
+    memcpy(&header, file.getData(), sizeof(header));
+
+    // the params which don't affect the method aren't compared
+    bool sameParams = header.method == params.method
+        && header.layout == params.layout
+        && (params.method != BVHBuildMethod_BinnedSAH || header.binCount == params.binCount)
+        && (params.method != BVHBuildMethod_LBVH || header.mortonBits == params.mortonBits)
+        && (params.method != BVHBuildMethod_SBVH || (header.binCount == params.binCount && header.splitOverlapThreshold == params.splitOverlapThreshold));
+
+    bool valid = header.magic == BVHFileHeader::kMagic
+        && header.version == BVHFileHeader::kVersion
+        && header.headerSize == sizeof(BVHFileHeader)
+        && header.nodeSize == sizeof(BVHNode)
+        && sameParams
+        && header.itemCount == itemCount
+        && header.rootNodeIndex < header.nodeCount
+        && header.nodeOffset <= file.getSize()
+        && header.nodeCount <= (file.getSize() - header.nodeOffset) / sizeof(BVHNode)
+        && header.itemRefOffset <= file.getSize()
+        && header.itemRefCount <= (file.getSize() - header.itemRefOffset) / sizeof(uint32_t);
+
+    // hashing is the slowest check, done last
+    if (!valid || header.contentHash != computeContentHash(items, itemCount))
+        return std::nullopt;
+
+    // Copied so the tree owns its nodes like a built one, which is a copy from
+    // the page cache and far cheaper than a build. BVHNode isn't trivially
+    // copyable (float3 has its own copy operators), nodes go through FileNode.
+    struct FileNode
+    {
+        float aabbMin[3];
+        float aabbMax[3];
+        uint32_t firstChildOrItemRef;
+        uint32_t itemCount;
+    };
+    static_assert(sizeof(FileNode) == sizeof(BVHNode));
+
+    NodePool nodePool(header.nodeCount);
+    for (uint32_t i=0; i<header.nodeCount; i++)
+    {
+        FileNode fileNode;
+        memcpy(&fileNode, file.getData() + header.nodeOffset + uint64_t(i) * sizeof(FileNode), sizeof(FileNode));
+
+        BVHNode& node = nodePool[i];
+        node.aabbMin = float3(fileNode.aabbMin);
+        node.aabbMax = float3(fileNode.aabbMax);
+        if (fileNode.itemCount > 0)
+            node.initLeafNode(fileNode.firstChildOrItemRef, fileNode.itemCount);
+        else
+            node.initInternalNode(fileNode.firstChildOrItemRef);
+    }
+
+    ItemRefs itemRefs(header.itemRefCount);
+    memcpy(itemRefs.data(), file.getData() + header.itemRefOffset, itemRefs.size() * sizeof(uint32_t));
+
+    // a damaged file must not send traversal out of bounds
+    for (const BVHNode& node : nodePool)
+    {
+        bool inRange = node.isLeaf()
+            ? uint64_t(node.firstItemRef()) + node.itemCount <= itemRefs.size()
+            : uint64_t(node.firstChild()) + BVHNode::kChildCount <= nodePool.size();
+        if (!inRange)
+            return std::nullopt;
+    }
+    for (uint32_t itemRef : itemRefs)
+    {
+        if (itemRef >= itemCount)
+            return std::nullopt;
+    }
+
+    // nor around a cycle, or deeper than the traversal stacks: every node must be
+    // reached exactly once from the root, within kMaxDepth levels. Children have to
+    // follow their parent as refit() relies on, all layouts but the root keep that.
+    {
+        struct Visit
+        {
+            uint32_t nodeIndex;
+            uint32_t depth;
+        };
+
+        std::vector<bool> visited(nodePool.size());
+        std::vector<Visit> stack = { { header.rootNodeIndex, 0 } };
+        while (!stack.empty())
+        {
+            Visit visit = stack.back();
+            stack.pop_back();
+
+            if (visited[visit.nodeIndex] || visit.depth > kMaxDepth)
+                return std::nullopt;
+            visited[visit.nodeIndex] = true;
+
+            const BVHNode& node = nodePool[visit.nodeIndex];
+            if (!node.isLeaf())
+            {
+                if (visit.nodeIndex != header.rootNodeIndex && node.firstChild() <= visit.nodeIndex)
+                    return std::nullopt;
+
+                stack.push_back({ node.firstChild(), visit.depth + 1 });
+                stack.push_back({ node.firstChild() + 1, visit.depth + 1 });
+            }
+        }
+    }
+
+    return BVH(items, itemCount, params, std::move(nodePool), std::move(itemRefs), header.rootNodeIndex);
+}
+
+BVH::BVH(const Item* items, uint32_t itemCount, const BVHBuildParams& params, NodePool&& nodePool, ItemRefs&& itemRefs, uint32_t rootNodeIndex)
+    : items(items)
+    , itemRefs(std::move(itemRefs))
+    , itemCount(itemCount)
+    , params(params)
+    , nodePool(std::move(nodePool))
+    , rootNodeIndex(rootNodeIndex)
+{
+    // derived from the items, cheaper to rebuild than to store
+    buildTriBlocks();
+
+#ifdef INTERSECTION_REORDER_NODES
+    IF_PROFILING(stats.reorderNodes = true);
+#endif
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Leaves
+///////////////////////////////////////////////////////////////////////////////
+
+void BVH::buildTriBlocks()
+{
+    PROFILE_ZONE("BVH tri blocks");
+#ifdef BVH_USE_TRI_BLOCKS
+    if (params.triKernel == BVHTriKernel_Watertight)
+    {
+        triVertexBlocks.assign((itemRefs.size() + 3) / 4, TriVertexBlock4());
+        for (uint32_t i=0; i<itemRefs.size(); i++)
+            triVertexBlocks[i / 4].setTri(i % 4, getItem(i), itemRefs[i]);
+    }
+    else
+    {
+        triBlocks.assign((itemRefs.size() + 3) / 4, TriBlock4());
+        for (uint32_t i=0; i<itemRefs.size(); i++)
+            triBlocks[i / 4].setTri(i % 4, getItem(i), itemRefs[i]);
+    }
+#endif
+}
+
+void BVH::intersectLeaf(Math::Ray& ray, const Math::RaySimd4& ray4, const BVHNode& node) const
+{
+#ifdef BVH_USE_TRI_BLOCKS
+    if (params.triKernel == BVHTriKernel_Watertight)
+        intersectRayTriBlocks(ray, ray4, triVertexBlocks.data(), node.firstItemRef(), node.itemCount);
+    else
+        intersectRayTriBlocks(ray, ray4, triBlocks.data(), node.firstItemRef(), node.itemCount);
+#else
+    for (uint32_t i=0; i<node.itemCount; i++)
+    {
+        uint32_t itemIndex = itemRefs[node.firstItemRef() + i];
+        if (params.triKernel == BVHTriKernel_Watertight)
+            intersectRayTriWatertight(ray, ray4.shear, items[itemIndex], itemIndex);
+        else
+            intersectRayTri(ray, items[itemIndex], itemIndex);
+    }
+#endif
+}
+
+bool BVH::occludedLeaf(const Math::Ray& ray, const Math::RaySimd4& ray4, const BVHNode& node) const
+{
+#ifdef BVH_USE_TRI_BLOCKS
+    if (params.triKernel == BVHTriKernel_Watertight)
+        return occludeRayTriBlocks(ray, ray4, triVertexBlocks.data(), node.firstItemRef(), node.itemCount);
+    else
+        return occludeRayTriBlocks(ray, ray4, triBlocks.data(), node.firstItemRef(), node.itemCount);
+#else
+    for (uint32_t i=0; i<node.itemCount; i++)
+    {
+        const Item& item = getItem(node.firstItemRef() + i);
+        bool hit = params.triKernel == BVHTriKernel_Watertight ? occludeRayTriWatertight(ray, ray4.shear, item) : occludeRayTri(ray, item);
+        if (hit)
+            return true;
+    }
+    return false;
+#endif
+}
+
+void BVH::intersect(Math::Ray& ray, const BVHNode& node, BVHStats& stats) const
+{
+    IF_PROFILING(stats.intersectRayAabbCount++);
+    if (intersectRayAabb(ray, node.aabbMin, node.aabbMax) == Ray::kInf)
+        return;
+
+    if (node.isLeaf())
+    {
+        intersectLeaf(ray, RaySimd4(ray, params.triKernel == BVHTriKernel_Watertight), node);
+        IF_PROFILING(stats.intersectRayTriCount += node.itemCount);
+    }
+    else
+    {
+        static_assert(BVHNode::kChildCount == 2);
+        intersect(ray, nodePool[node.firstChild()], stats);
+        intersect(ray, nodePool[node.firstChild() + 1], stats);
+    } 
+}
+
+void BVH::intersect(Math::Ray& ray, BVHStats& stats) const
+{
+#ifdef INTERSECTION_REORDER_NODES
+    const BVHNode* node = &nodePool[rootNodeIndex];
+
+    // check if we hit root node aabb at all
+    IF_PROFILING(stats.intersectRayAabbCount++);
+    if (intersectRayAabb(ray, node->aabbMin, node->aabbMax) == Ray::kInf)
+        return;
+
+    RaySimd4 ray4(ray, params.triKernel == BVHTriKernel_Watertight);
+
+    const BVHNode* stack[kMaxDepth];
+    uint32_t stackPtr = 0;
+
+    while (1)
+    {
+        if (node->isLeaf())
+        {
+            intersectLeaf(ray, ray4, *node);
+            IF_PROFILING(stats.intersectRayTriCount += node->itemCount);
+            
+            if (stackPtr == 0)
+                break;
+
+            node = stack[--stackPtr];
+        }
+        else
+        {
+            // we want to traverse front front-to-back
+            static_assert(BVHNode::kChildCount == 2);
+            const BVHNode* child0 = &nodePool[node->firstChild()];
+            const BVHNode* child1 = &nodePool[node->firstChild() + 1];
+
+            // test both children with one SIMD slab test, lanes 2 and 3 repeat them
+            simd4f bmin[3], bmax[3];
+            for (uint8_t axis = 0; axis < CoordAxis_Count; axis++)
+            {
+                bmin[axis] = simd4f(child0->aabbMin[axis], child1->aabbMin[axis], child0->aabbMin[axis], child1->aabbMin[axis]);
+                bmax[axis] = simd4f(child0->aabbMax[axis], child1->aabbMax[axis], child0->aabbMax[axis], child1->aabbMax[axis]);
+            }
+            float dist[4];
+            intersectRayAabb4(ray4, ray.hit.t, bmin, bmax).store(dist);
+            float dist0 = dist[0];
+            float dist1 = dist[1];
+            IF_PROFILING(stats.intersectRayAabbCount += 2);
+
+            if (dist0 > dist1)
+            {
+                std::swap(dist0, dist1);
+                std::swap(child0, child1);
+            }
+
+            // at this point child0 is the front, child1 is the back
+            if (dist0 == Ray::kInf)
+            {
+                if (stackPtr == 0)
+                    break;
+                node = stack[--stackPtr];
+            }
+            else
+            {
+                node = child0;
+                if (dist1 != Ray::kInf) stack[stackPtr++] = child1;
+            }
+        }
+    }
+#else
+    intersect(ray, nodePool[rootNodeIndex], stats);
+#endif
+}
+
+bool BVH::occluded(const Math::Ray& ray, BVHStats& stats) const
+{
+    const BVHNode* node = &nodePool[rootNodeIndex];
+
+    IF_PROFILING(stats.intersectRayAabbCount++);
+    if (intersectRayAabb(ray, node->aabbMin, node->aabbMax) == Ray::kInf)
+        return false;
+
+    RaySimd4 ray4(ray, params.triKernel == BVHTriKernel_Watertight);
+
+    const BVHNode* stack[kMaxDepth];
+    uint32_t stackPtr = 0;
+
+    while (1)
+    {
+        if (node->isLeaf())
+        {
+            IF_PROFILING(stats.intersectRayTriCount += node->itemCount);
+            if (occludedLeaf(ray, ray4, *node))
+                return true;
+        }
+        else
+        {
+            static_assert(BVHNode::kChildCount == 2);
+            const BVHNode* child0 = &nodePool[node->firstChild()];
+            const BVHNode* child1 = &nodePool[node->firstChild() + 1];
+
+            simd4f bmin[3], bmax[3];
+            for (uint8_t axis = 0; axis < CoordAxis_Count; axis++)
+            {
+                bmin[axis] = simd4f(child0->aabbMin[axis], child1->aabbMin[axis], child0->aabbMin[axis], child1->aabbMin[axis]);
+                bmax[axis] = simd4f(child0->aabbMax[axis], child1->aabbMax[axis], child0->aabbMax[axis], child1->aabbMax[axis]);
+            }
+            float dist[4];
+            intersectRayAabb4(ray4, ray.hit.t, bmin, bmax).store(dist);
+            IF_PROFILING(stats.intersectRayAabbCount += 2);
+
+            // any hit ends the query, so the order doesn't matter and isn't sorted
+            bool hit0 = dist[0] != Ray::kInf;
+            bool hit1 = dist[1] != Ray::kInf;
+            if (hit0 || hit1)
+            {
+                node = hit0 ? child0 : child1;
+                if (hit0 && hit1) stack[stackPtr++] = child1;
+                continue;
+            }
+        }
+
+        if (stackPtr == 0)
+            return false;
+
+        node = stack[--stackPtr];
+    }
+}
+
+// Packet traversal: each stack entry keeps the lanes that hit its box, as
+// lanes that missed a node can't hit anything below it. Children are visited
+// nearest first according to the smallest entry distance of their lanes.
+template <uint32_t N>
+void BVH::intersect(Math::RayPacket<N>& packet, uint32_t activeMask, BVHStats& stats) const
+{
+    struct StackEntry
+    {
+        const BVHNode* node;
+        uint32_t laneMask;
+    };
+
+    // returns the lanes of laneMask hitting the node, and the smallest entry distance among them
+    auto intersectNode = [&packet, &stats](const BVHNode& node, uint32_t laneMask, float& outDist) -> uint32_t
+    {
+        uint32_t hitMask = 0;
+        outDist = Ray::kInf;
+        for (uint32_t group = 0; group < RayPacket<N>::kGroupCount; group++)
+        {
+            uint32_t groupMask = (laneMask >> (group * 4)) & 0xf;
+            if (groupMask == 0)
+                continue;
+
+            IF_PROFILING(stats.intersectRayAabbCount += std::popcount(groupMask));
+
+            simd4f dist;
+            groupMask &= intersectPacketAabb4(packet, group, node.aabbMin, node.aabbMax, dist);
+            hitMask |= groupMask << (group * 4);
+
+            for (uint32_t lane = 0; lane < 4; lane++)
+                if (groupMask & (1 << lane))
+                    outDist = std::min(outDist, dist[lane]);
+        }
+        return hitMask;
+    };
+
+    const BVHNode* node = &nodePool[rootNodeIndex];
+
+    float rootDist;
+    uint32_t laneMask = intersectNode(*node, activeMask, rootDist);
+    if (laneMask == 0)
+        return;
+
+    StackEntry stack[kMaxDepth];
+    uint32_t stackPtr = 0;
+
+    while (1)
+    {
+        if (node->isLeaf())
+        {
+            if (params.triKernel == BVHTriKernel_Watertight)
+            {
+                // the watertight test has no packet form, lanes go through the single ray leaf
+                for (uint32_t lane = 0; lane < N; lane++)
+                {
+                    if ((laneMask & (1u << lane)) == 0)
+                        continue;
+
+                    Ray ray(float3(packet.O[0][lane], packet.O[1][lane], packet.O[2][lane]),
+                            float3(packet.D[0][lane], packet.D[1][lane], packet.D[2][lane]), packet.t[lane]);
+                    intersectLeaf(ray, RaySimd4(ray, true), *node);
+                    if (ray.hit.t < packet.t[lane])
+                    {
+                        packet.t[lane] = ray.hit.t;
+                        packet.u[lane] = ray.hit.u;
+                        packet.v[lane] = ray.hit.v;
+                        packet.primId[lane] = ray.hit.primId;
+                    }
+                }
+            }
+            else
+            {
+                for (uint32_t i=0; i<node->itemCount; i++)
+                {
+#ifdef BVH_USE_TRI_BLOCKS
+                    uint32_t itemRef = node->firstItemRef() + i;
+                    const TriBlock4& block = triBlocks[itemRef / 4];
+#else
+                    uint32_t itemIndex = itemRefs[node->firstItemRef() + i];
+#endif
+                    for (uint32_t group = 0; group < RayPacket<N>::kGroupCount; group++)
+                    {
+                        uint32_t groupMask = (laneMask >> (group * 4)) & 0xf;
+                        if (groupMask == 0)
+                            continue;
+#ifdef BVH_USE_TRI_BLOCKS
+                        intersectPacketTri4(packet, group, groupMask, block, itemRef % 4);
+#else
+                        intersectPacketTri4(packet, group, groupMask, items[itemIndex], itemIndex);
+#endif
+                    }
+                }
+            }
+            IF_PROFILING(stats.intersectRayTriCount += node->itemCount * std::popcount(laneMask));
+
+            if (stackPtr == 0)
+                break;
+
+            node = stack[--stackPtr].node;
+            laneMask = stack[stackPtr].laneMask;
+        }
+        else
+        {
+            const BVHNode* child0 = &nodePool[node->firstChild()];
+            const BVHNode* child1 = &nodePool[node->firstChild() + 1];
+
+            float dist0, dist1;
+            uint32_t laneMask0 = intersectNode(*child0, laneMask, dist0);
+            uint32_t laneMask1 = intersectNode(*child1, laneMask, dist1);
+
+            if (dist0 > dist1)
+            {
+                std::swap(dist0, dist1);
+                std::swap(child0, child1);
+                std::swap(laneMask0, laneMask1);
+            }
+
+            // at this point child0 is the front, child1 is the back
+            if (laneMask0 == 0)
+            {
+                if (stackPtr == 0)
+                    break;
+                node = stack[--stackPtr].node;
+                laneMask = stack[stackPtr].laneMask;
+            }
+            else
+            {
+                node = child0;
+                laneMask = laneMask0;
+                if (laneMask1 != 0) stack[stackPtr++] = { child1, laneMask1 };
+            }
+        }
+    }
+}
+
+template void BVH::intersect(Math::RayPacket<4>& packet, uint32_t activeMask, BVHStats& stats) const;
+template void BVH::intersect(Math::RayPacket<8>& packet, uint32_t activeMask, BVHStats& stats) const;
+template void BVH::intersect(Math::RayPacket<16>& packet, uint32_t activeMask, BVHStats& stats) const;
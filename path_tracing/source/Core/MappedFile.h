@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+///////////////////////////////////////////////////////////////////////////////
+// MappedFile
+///////////////////////////////////////////////////////////////////////////////
+
+// Read-only memory mapping of a whole file. The pages are loaded by the OS on
+// first access, so opening a large file is cheap and nothing is copied.
+class MappedFile
+{
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+
+#if defined(_WIN32)
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#endif
+
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // returns false if the file doesn't exist, is empty or can't be mapped
+    bool open(const char* filepath);
+    void close();
+
+    bool isOpen() const { return data != nullptr; }
+    const uint8_t* getData() const { return data; }
+    size_t getSize() const { return size; }
+};
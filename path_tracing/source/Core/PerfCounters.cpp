@@ -0,0 +1,139 @@
+#include "PerfCounters.h"
+
+#if defined(__linux__)
+    #include <linux/perf_event.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+    #include <cstring>
+#endif
+
+const char* toString(PerfCounter counter)
+{
+    switch (counter)
+    {
+        case PerfCounter_TaskClock: return "task clock ns";
+        case PerfCounter_Cycles: return "cycles";
+        case PerfCounter_Instructions: return "instructions";
+        case PerfCounter_L1DMisses: return "L1D misses";
+        case PerfCounter_LLCMisses: return "LLC misses";
+        case PerfCounter_BranchMisses: return "branch misses";
+        default: return "unknown";
+    }
+}
+
+bool PerfCounters::isAnyAvailable() const
+{
+    for (int fd : fds)
+    {
+        if (fd >= 0)
+            return true;
+    }
+    return false;
+}
+
+#if defined(__linux__)
+
+PerfCounters::PerfCounters()
+{
+    struct EventDesc
+    {
+        uint32_t type;
+        uint64_t config;
+    };
+    const EventDesc events[PerfCounter_Count] =
+    {
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    };
+
+    // separate events rather than a group, one unsupported event doesn't disable the rest
+    for (uint32_t i = 0; i < PerfCounter_Count; i++)
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        // calling thread, any CPU
+        fds[i] = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+}
+
+PerfCounters::~PerfCounters()
+{
+    for (int fd : fds)
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+}
+
+void PerfCounters::start()
+{
+    for (int fd : fds)
+    {
+        if (fd >= 0)
+        {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+PerfCounterValues PerfCounters::stop()
+{
+    for (int fd : fds)
+    {
+        if (fd >= 0)
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    }
+
+    PerfCounterValues result;
+    for (uint32_t i = 0; i < PerfCounter_Count; i++)
+    {
+        if (fds[i] < 0)
+            continue;
+
+        // value, time enabled, time running
+        uint64_t data[3];
+        if (read(fds[i], data, sizeof(data)) != ssize_t(sizeof(data)) || data[2] == 0)
+            continue;
+
+        result.values[i] = data[2] < data[1] ? uint64_t(double(data[0]) * double(data[1]) / double(data[2])) : data[0];
+        result.validMask |= 1u << i;
+    }
+    return result;
+}
+
+#else
+
+PerfCounters::PerfCounters()
+{
+    for (int& fd : fds)
+        fd = -1;
+}
+
+PerfCounters::~PerfCounters()
+{
+}
+
+void PerfCounters::start()
+{
+}
+
+PerfCounterValues PerfCounters::stop()
+{
+    return PerfCounterValues();
+}
+
+#endif
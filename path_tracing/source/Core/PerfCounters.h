@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+
+///////////////////////////////////////////////////////////////////////////////
+// Hardware performance counters
+///////////////////////////////////////////////////////////////////////////////
+
+enum PerfCounter
+{
+    PerfCounter_TaskClock,          // ns on the CPU, a software counter, mostly available when the others aren't
+    PerfCounter_Cycles,
+    PerfCounter_Instructions,
+    PerfCounter_L1DMisses,          // L1 data cache read misses
+    PerfCounter_LLCMisses,          // last level cache misses
+    PerfCounter_BranchMisses,
+    PerfCounter_Count
+};
+
+const char* toString(PerfCounter counter);
+
+struct PerfCounterValues
+{
+    uint64_t values[PerfCounter_Count] = {};
+    uint32_t validMask = 0;         // bit per PerfCounter that could be read
+
+    bool isValid(PerfCounter counter) const { return validMask & (1u << counter); }
+    uint64_t operator[](PerfCounter counter) const { return values[counter]; }
+
+    PerfCounterValues& operator+=(const PerfCounterValues& other)
+    {
+        for (uint32_t i = 0; i < PerfCounter_Count; i++)
+            values[i] += other.values[i];
+        validMask |= other.validMask;
+        return *this;
+    }
+};
+
+// Counters of the calling thread, through perf_event_open on Linux. User space
+// only, so perf_event_paranoid <= 2 is enough. Counters the kernel or the CPU
+// don't support (VMs often have no PMU) stay invalid, on other platforms all do.
+// Values are scaled up when the kernel multiplexes the counters.
+class PerfCounters
+{
+    int fds[PerfCounter_Count];
+
+public:
+    PerfCounters();
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool isAvailable(PerfCounter counter) const { return fds[counter] >= 0; }
+    bool isAnyAvailable() const;
+
+    // reset and enable all counters
+    void start();
+
+    // disable and read all counters
+    PerfCounterValues stop();
+};
+
+// Adds the counts of its lifetime to values
+class PerfScope
+{
+    PerfCounters& counters;
+    PerfCounterValues& values;
+
+public:
+    PerfScope(PerfCounters& counters, PerfCounterValues& values)
+        : counters(counters)
+        , values(values)
+    {
+        counters.start();
+    }
+
+    ~PerfScope()
+    {
+        values += counters.stop();
+    }
+};
@@ -0,0 +1,112 @@
+#include "Profiler.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct ThreadBuffer
+{
+    uint32_t threadId;
+    uint64_t writeCount = 0;    // total, the ring index is writeCount % kThreadBufferEventCount
+    std::vector<ProfileEvent> events;
+};
+
+struct ThreadBufferRegistry
+{
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+};
+
+static ThreadBufferRegistry& getRegistry()
+{
+    static ThreadBufferRegistry registry;
+    return registry;
+}
+
+// registered on the first event of the thread, owned by the registry
+static thread_local ThreadBuffer* tlsThreadBuffer = nullptr;
+
+static ThreadBuffer& getThreadBuffer()
+{
+    if (!tlsThreadBuffer)
+    {
+        ThreadBufferRegistry& registry = getRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+
+        auto buffer = std::make_unique<ThreadBuffer>();
+        buffer->threadId = uint32_t(registry.buffers.size());
+        buffer->events.resize(Profiler::kThreadBufferEventCount);
+        tlsThreadBuffer = buffer.get();
+        registry.buffers.push_back(std::move(buffer));
+    }
+    return *tlsThreadBuffer;
+}
+
+uint64_t Profiler::getTimeNs()
+{
+    using clock = std::chrono::steady_clock;
+    static const clock::time_point start = clock::now();
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count());
+}
+
+void Profiler::recordEvent(const char* name, uint64_t beginNs, uint64_t endNs)
+{
+    ThreadBuffer& buffer = getThreadBuffer();
+    buffer.events[buffer.writeCount % kThreadBufferEventCount] = { name, beginNs, endNs };
+    buffer.writeCount++;
+}
+
+uint64_t Profiler::getEventCount()
+{
+    ThreadBufferRegistry& registry = getRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    uint64_t eventCount = 0;
+    for (const auto& buffer : registry.buffers)
+        eventCount += std::min<uint64_t>(buffer->writeCount, kThreadBufferEventCount);
+    return eventCount;
+}
+
+bool Profiler::saveChromeTrace(const char* filepath)
+{
+    FILE* file = fopen(filepath, "w");
+    if (!file)
+        return false;
+
+    ThreadBufferRegistry& registry = getRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    // complete events ("ph": "X") in us, nesting is derived from the times
+    fprintf(file, "{\"traceEvents\":[\n");
+    const char* separator = "";
+    for (const auto& buffer : registry.buffers)
+    {
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}", separator, buffer->threadId, buffer->threadId);
+        separator = ",\n";
+
+        uint64_t count = std::min<uint64_t>(buffer->writeCount, kThreadBufferEventCount);
+        uint64_t first = buffer->writeCount - count;
+        for (uint64_t i = first; i < buffer->writeCount; i++)
+        {
+            const ProfileEvent& event = buffer->events[i % kThreadBufferEventCount];
+            fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                separator, event.name, buffer->threadId, event.beginNs * 1e-3, (event.endNs - event.beginNs) * 1e-3);
+        }
+    }
+    fprintf(file, "\n]}\n");
+
+    bool success = ferror(file) == 0;
+    fclose(file);
+    return success;
+}
+
+void Profiler::clear()
+{
+    ThreadBufferRegistry& registry = getRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    for (const auto& buffer : registry.buffers)
+        buffer->writeCount = 0;
+}
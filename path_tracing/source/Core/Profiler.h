@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+
+///////////////////////////////////////////////////////////////////////////////
+// Options
+///////////////////////////////////////////////////////////////////////////////
+
+// Record PROFILE_ZONE scopes. Without it the macros compile to nothing. Off by
+// default, defined for every target by configuring with -DPATH_TRACING_PROFILER=ON.
+//#define PROFILER_ENABLED
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Profiler
+///////////////////////////////////////////////////////////////////////////////
+
+struct ProfileEvent
+{
+    const char* name;       // static string, only the pointer is kept
+    uint64_t beginNs;
+    uint64_t endNs;
+};
+
+// Collects scoped zones of all threads. Each thread writes to its own ring
+// buffer without locking, once full the oldest events are overwritten.
+// Buffers outlive their threads, so zones of finished TaskSystem workers are
+// still exported.
+class Profiler
+{
+public:
+    static constexpr uint32_t kThreadBufferEventCount = 64 * 1024;
+
+    // ns since the first call
+    static uint64_t getTimeNs();
+
+    static void recordEvent(const char* name, uint64_t beginNs, uint64_t endNs);
+
+    // events recorded so far and still in the ring buffers
+    static uint64_t getEventCount();
+
+    // Chrome trace event format, open with chrome://tracing or ui.perfetto.dev.
+    // Other threads must not record while it runs.
+    static bool saveChromeTrace(const char* filepath);
+
+    static void clear();
+};
+
+// Records the time between construction and destruction, when active
+class ProfileZone
+{
+    const char* name;
+    uint64_t beginNs;
+    bool active;
+
+public:
+    explicit ProfileZone(const char* name, bool active = true)
+        : name(name)
+        , beginNs(active ? Profiler::getTimeNs() : 0)
+        , active(active)
+    {
+    }
+
+    ~ProfileZone()
+    {
+        if (active)
+            Profiler::recordEvent(name, beginNs, Profiler::getTimeNs());
+    }
+
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#ifdef PROFILER_ENABLED
+    #define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+    #define PROFILE_ZONE_IF(condition, name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name, condition)
+#else
+    #define PROFILE_ZONE(name)
+    #define PROFILE_ZONE_IF(condition, name)
+#endif
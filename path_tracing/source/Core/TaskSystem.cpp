@@ -0,0 +1,140 @@
+#include "TaskSystem.h"
+#include <cassert>
+
+// worker threads remember which system they belong to and their queue
+static thread_local const TaskSystem* tlsTaskSystem = nullptr;
+static thread_local uint32_t tlsThreadIndex = 0;
+
+TaskSystem::TaskSystem(uint32_t threadCount)
+{
+    if (threadCount == 0)
+        threadCount = getHardwareThreadCount();
+
+    queues.reserve(threadCount);
+    for (uint32_t i=0; i<threadCount; i++)
+        queues.push_back(std::make_unique<TaskQueue>());
+
+    workers.reserve(threadCount - 1);
+    for (uint32_t i=1; i<threadCount; i++)
+        workers.emplace_back(&TaskSystem::workerMain, this, i);
+}
+
+TaskSystem::~TaskSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        quit = true;
+    }
+    sleepCondition.notify_all();
+
+    for (std::thread& worker : workers)
+        worker.join();
+
+    assert(queuedTaskCount == 0);
+}
+
+uint32_t TaskSystem::getHardwareThreadCount()
+{
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+uint32_t TaskSystem::getThreadIndex() const
+{
+    return (tlsTaskSystem == this) ? tlsThreadIndex : 0;
+}
+
+void TaskSystem::submit(TaskGroup& group, Task task)
+{
+    // no workers, run inline
+    if (workers.empty())
+    {
+        task();
+        return;
+    }
+
+    group.pendingCount.fetch_add(1, std::memory_order_relaxed);
+
+    // count before pushing so the count never drops below the number of queued tasks,
+    // under the sleep mutex so a worker can't miss the wake up between its check and its wait
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        queuedTaskCount.fetch_add(1, std::memory_order_release);
+    }
+    {
+        TaskQueue& queue = *queues[getThreadIndex()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back({ std::move(task), &group });
+    }
+    sleepCondition.notify_one();
+}
+
+void TaskSystem::wait(TaskGroup& group)
+{
+    // help with the queued tasks instead of blocking, the tasks we wait on may be
+    // queued behind others and nested waits would otherwise starve the pool
+    uint32_t threadIndex = getThreadIndex();
+    while (!group.isDone())
+    {
+        if (!tryRunTask(threadIndex))
+            std::this_thread::yield();
+    }
+}
+
+bool TaskSystem::popTask(uint32_t threadIndex, QueuedTask& outTask)
+{
+    TaskQueue& queue = *queues[threadIndex];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty())
+        return false;
+
+    outTask = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    return true;
+}
+
+bool TaskSystem::stealTask(uint32_t threadIndex, QueuedTask& outTask)
+{
+    const uint32_t queueCount = uint32_t(queues.size());
+    for (uint32_t i=1; i<queueCount; i++)
+    {
+        TaskQueue& queue = *queues[(threadIndex + i) % queueCount];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty())
+            continue;
+
+        outTask = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+        return true;
+    }
+    return false;
+}
+
+bool TaskSystem::tryRunTask(uint32_t threadIndex)
+{
+    QueuedTask queuedTask;
+    if (!popTask(threadIndex, queuedTask) && !stealTask(threadIndex, queuedTask))
+        return false;
+
+    queuedTaskCount.fetch_sub(1, std::memory_order_relaxed);
+
+    queuedTask.task();
+    queuedTask.group->pendingCount.fetch_sub(1, std::memory_order_release);
+    return true;
+}
+
+void TaskSystem::workerMain(uint32_t threadIndex)
+{
+    tlsTaskSystem = this;
+    tlsThreadIndex = threadIndex;
+
+    while (1)
+    {
+        if (tryRunTask(threadIndex))
+            continue;
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleepCondition.wait(lock, [this]() { return quit || queuedTaskCount.load(std::memory_order_acquire) > 0; });
+        if (quit && queuedTaskCount == 0)
+            return;
+    }
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+// TaskGroup
+///////////////////////////////////////////////////////////////////////////////
+
+// Tracks the tasks submitted together so the submitter can wait for them.
+struct TaskGroup
+{
+    std::atomic<uint32_t> pendingCount = 0;
+
+    bool isDone() const { return pendingCount.load(std::memory_order_acquire) == 0; }
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// TaskSystem
+///////////////////////////////////////////////////////////////////////////////
+
+// Fixed size thread pool with work stealing. Every thread owns a task queue:
+// the owner pushes and pops at the back (LIFO, hot data), idle threads steal
+// from the front of the other queues (FIFO, the oldest and largest tasks).
+// The thread calling wait() executes tasks while it waits, so tasks are allowed
+// to submit and wait on nested tasks.
+//
+// Threads which aren't workers share queue and thread index 0, only one such
+// thread should use a TaskSystem at a time.
+class TaskSystem
+{
+public:
+    using Task = std::function<void()>;
+
+private:
+    struct QueuedTask
+    {
+        Task task;
+        TaskGroup* group;
+    };
+
+    // padded so queues of different threads don't share cache lines
+    struct alignas(64) TaskQueue
+    {
+        std::deque<QueuedTask> tasks;
+        std::mutex mutex;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<TaskQueue>> queues;     // one per thread, 0 for the external thread
+
+    std::atomic<uint32_t> queuedTaskCount = 0;
+    std::mutex sleepMutex;
+    std::condition_variable sleepCondition;
+    bool quit = false;
+
+    bool popTask(uint32_t threadIndex, QueuedTask& outTask);
+    bool stealTask(uint32_t threadIndex, QueuedTask& outTask);
+    bool tryRunTask(uint32_t threadIndex);
+    void workerMain(uint32_t threadIndex);
+
+public:
+    // threadCount includes the thread calling wait(), 0 means one per hardware thread
+    explicit TaskSystem(uint32_t threadCount = 0);
+    ~TaskSystem();
+
+    TaskSystem(const TaskSystem&) = delete;
+    TaskSystem& operator=(const TaskSystem&) = delete;
+
+    uint32_t getThreadCount() const { return uint32_t(workers.size()) + 1; }
+
+    // index of the calling thread in [0, getThreadCount()), for per-thread data
+    uint32_t getThreadIndex() const;
+
+    void submit(TaskGroup& group, Task task);
+    void wait(TaskGroup& group);
+
+    // Splits [begin, end) into chunks of at least grainSize and calls func(chunkBegin, chunkEnd) in parallel.
+    template <typename Func>
+    void parallelFor(uint32_t begin, uint32_t end, uint32_t grainSize, Func func);
+
+    static uint32_t getHardwareThreadCount();
+};
+
+template <typename Func>
+void TaskSystem::parallelFor(uint32_t begin, uint32_t end, uint32_t grainSize, Func func)
+{
+    if (begin >= end)
+        return;
+
+    uint32_t count = end - begin;
+    uint32_t chunkCount = std::max(1u, std::min(getThreadCount() * 4, count / std::max(1u, grainSize)));
+    uint32_t chunkSize = (count + chunkCount - 1) / chunkCount;
+
+    TaskGroup group;
+    for (uint32_t chunkBegin = begin + chunkSize; chunkBegin < end; chunkBegin += chunkSize)
+    {
+        uint32_t chunkEnd = std::min(end, chunkBegin + chunkSize);
+        submit(group, [&func, chunkBegin, chunkEnd]() { func(chunkBegin, chunkEnd); });
+    }
+    func(begin, std::min(end, begin + chunkSize));
+    wait(group);
+}
@@ -0,0 +1,86 @@
+#include "AccumulationBuffer.h"
+#include "Image.h"
+#include "../Math/Simd.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+using namespace Math;
+
+static_assert(sizeof(AccumulationBuffer::Pixel) == 4 * sizeof(float));
+
+// Narkowicz 2015, ACES Filmic Tone Mapping Curve
+static float tonemapACES(float x)
+{
+    float y = (x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f);
+    return std::min(std::max(y, 0.0f), 1.0f);
+}
+
+static simd4f tonemapACES(const simd4f& x)
+{
+    simd4f y = (x * (simd4f(2.51f) * x + simd4f(0.03f))) / (x * (simd4f(2.43f) * x + simd4f(0.59f)) + simd4f(0.14f));
+    return min(max(y, simd4f(0.0f)), simd4f(1.0f));
+}
+
+AccumulationBuffer::AccumulationBuffer(uint32_t width, uint32_t height)
+    : width(width)
+    , height(height)
+    , pixels(width * height)
+    , luminanceSqrSums(width * height)
+{
+    clear();
+}
+
+void AccumulationBuffer::clear()
+{
+    for (Pixel& pixel : pixels)
+        pixel = Pixel(0.0f);
+    std::fill(luminanceSqrSums.begin(), luminanceSqrSums.end(), 0.0f);
+}
+
+float AccumulationBuffer::estimateError(uint32_t x, uint32_t y, float exposure) const
+{
+    const Pixel& pixel = (*this)(x, y);
+    float n = pixel.a;
+    if (n < 2.0f)
+        return std::numeric_limits<float>::infinity();
+
+    float mean = getLuminance(float3(pixel.r, pixel.g, pixel.b)) / n;
+    float variance = std::max(0.0f, (luminanceSqrSums[y*width + x] - n * mean * mean) / (n - 1.0f));
+    float standardError = std::sqrt(variance / n);
+
+    // same tonemap and gamma as resolve()
+    return std::sqrt(tonemapACES((mean + standardError) * exposure)) - std::sqrt(tonemapACES(mean * exposure));
+}
+
+uint64_t AccumulationBuffer::getSampleCount() const
+{
+    uint64_t sampleCount = 0;
+    for (const Pixel& pixel : pixels)
+        sampleCount += uint64_t(pixel.a);
+    return sampleCount;
+}
+
+void AccumulationBuffer::resolve(Image& img, uint32_t beginRow, uint32_t endRow, float exposure) const
+{
+    assert(img.width == width && img.height == height);
+
+    for (uint32_t y = beginRow; y < endRow; y++)
+    {
+        const Pixel* src = &pixels[y * width];
+        Image::Pixel* dst = &img(0, y);
+        for (uint32_t x = 0; x < width; x++)
+        {
+            // rgb and count in one register, the count lane is ignored after the divide
+            simd4f sum = simd4f::load(src[x].m_data);
+            float sampleCount = src[x].a;
+            simd4f scale = simd4f(sampleCount > 0.0f ? exposure / sampleCount : 0.0f);
+
+            simd4f color = sqrt(tonemapACES(sum * scale)) * simd4f(255.0f) + simd4f(0.5f);
+
+            float c[4];
+            color.store(c);
+            dst[x] = Image::Pixel(uint8_t(c[0]), uint8_t(c[1]), uint8_t(c[2]));
+        }
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "../Math/Color.h"
+#include "../Math/Vector.h"
+#include <cstdint>
+#include <vector>
+
+struct Image;
+
+// HDR framebuffer summing radiance samples over progressive passes. Each pixel
+// keeps its own sample count in alpha, so it can be resolved at any time, also
+// when pixels received different numbers of samples. The sum of squared sample
+// luminances is kept next to it for variance estimates.
+struct AccumulationBuffer
+{
+    using Pixel = Math::color4f;    // rgb: radiance sum, a: sample count
+
+    uint32_t width;
+    uint32_t height;
+    std::vector<Pixel> pixels;
+    std::vector<float> luminanceSqrSums;
+
+    AccumulationBuffer(uint32_t width, uint32_t height);
+
+    Pixel& operator()(uint32_t x, uint32_t y) { return pixels[y*width + x]; }
+    const Pixel& operator()(uint32_t x, uint32_t y) const { return pixels[y*width + x]; }
+
+    void clear();
+
+    static float getLuminance(const Math::float3& radiance)
+    {
+        return 0.2126f * radiance.x + 0.7152f * radiance.y + 0.0722f * radiance.z;
+    }
+
+    void addSample(uint32_t x, uint32_t y, const Math::float3& radiance)
+    {
+        float luminance = getLuminance(radiance);
+        addSamples(x, y, radiance, luminance * luminance, 1);
+    }
+
+    // sums of sampleCount samples, luminanceSqrSum is the sum of their squared luminances
+    void addSamples(uint32_t x, uint32_t y, const Math::float3& radianceSum, float luminanceSqrSum, uint32_t sampleCount)
+    {
+        Pixel& pixel = (*this)(x, y);
+        pixel.r += radianceSum.x;
+        pixel.g += radianceSum.y;
+        pixel.b += radianceSum.z;
+        pixel.a += float(sampleCount);
+        luminanceSqrSums[y*width + x] += luminanceSqrSum;
+    }
+
+    // Standard error of the mean luminance carried through the resolve tonemap,
+    // in display units [0, 1]: noise in dark pixels is weighted up like gamma
+    // does, highlights compressed by the curve are weighted down.
+    // Infinite with fewer than 2 samples.
+    float estimateError(uint32_t x, uint32_t y, float exposure = 1.0f) const;
+
+    uint64_t getSampleCount() const;
+
+    // Average, exposure, ACES filmic tonemap and gamma 2 of rows [beginRow, endRow)
+    // into img, one SIMD register per pixel. Pixels without samples resolve to black.
+    void resolve(Image& img, uint32_t beginRow, uint32_t endRow, float exposure = 1.0f) const;
+    void resolve(Image& img, float exposure = 1.0f) const { resolve(img, 0, height, exposure); }
+};
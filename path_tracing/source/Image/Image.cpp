@@ -1,4 +1,4 @@
-#include "image.h"
+#include "Image.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
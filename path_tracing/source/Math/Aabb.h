@@ -15,18 +15,19 @@ struct Aabb
     Aabb(const float3& min, const float3& max);
 
     Aabb& expand(const float3& p);
+    Aabb& expand(const Aabb& other);
 
     float3 extent() const;
     float area() const;
 };
 
-Aabb::Aabb()
+inline Aabb::Aabb()
     : min( std::numeric_limits<float>::max())
     , max(-std::numeric_limits<float>::max())
 {
 }
 
-Aabb::Aabb(const float3& min, const float3& max)
+inline Aabb::Aabb(const float3& min, const float3& max)
     : min(min)
     , max(max)
 {    
@@ -39,6 +40,13 @@ inline Aabb& Aabb::expand(const float3& p)
     return *this;
 }
 
+inline Aabb& Aabb::expand(const Aabb& other)
+{
+    min = Math::min(min, other.min);
+    max = Math::max(max, other.max);
+    return *this;
+}
+
 inline float3 Aabb::extent() const
 {
     return max - min;
@@ -1,13 +1,15 @@
 #pragma once
 
 #include "Ray.h"
+#include "Simd.h"
 #include "Tri.h"
 
 namespace Math
 {
 
 // https://en.wikipedia.org/wiki/M%C3%B6ller%E2%80%93Trumbore_intersection_algorithm
-inline void intersectRayTri(Ray& ray, const Tri& tri, const float kEpsilon = 0.0001f)
+// ray.hit is only written for a closer hit, primId identifies tri in it.
+inline void intersectRayTri(Ray& ray, const Tri& tri, uint32_t primId, const float kEpsilon = 0.0001f)
 {
     const float3 edge1 = tri.vertex1 - tri.vertex0;
     const float3 edge2 = tri.vertex2 - tri.vertex0;
@@ -22,19 +24,355 @@ inline void intersectRayTri(Ray& ray, const Tri& tri, const float kEpsilon = 0.0
     const float v = f * dot( ray.D, q );
     if (v < 0 || u + v > 1) return;
     const float t = f * dot( edge2, q );
-    if (t > kEpsilon) ray.t = min( ray.t, t );
+    if (t > kEpsilon && t < ray.hit.t)
+    {
+        ray.hit.t = t;
+        ray.hit.u = u;
+        ray.hit.v = v;
+        ray.hit.primId = primId;
+    }
 }
 
+// Any-hit version of intersectRayTri: true for a hit in (kEpsilon, ray.hit.t).
+// The determinant's sign is folded into the comparisons, so it needs no division.
+inline bool occludeRayTri(const Ray& ray, const Tri& tri, const float kEpsilon = 0.0001f)
+{
+    const float3 edge1 = tri.vertex1 - tri.vertex0;
+    const float3 edge2 = tri.vertex2 - tri.vertex0;
+    const float3 h = cross( ray.D, edge2 );
+    float a = dot( edge1, h );
+    if (a > -kEpsilon && a < kEpsilon) return false; // ray parallel to triangle
+    const float sign = a < 0 ? -1.0f : 1.0f;
+    a *= sign;
+    const float3 s = ray.O - tri.vertex0;
+    const float u = sign * dot( s, h );
+    if (u < 0 || u > a) return false;
+    const float3 q = cross( s, edge1 );
+    const float v = sign * dot( ray.D, q );
+    if (v < 0 || u + v > a) return false;
+    const float t = sign * dot( edge2, q );
+    return t > kEpsilon * a && t < ray.hit.t * a;
+}
+
+// Watertight ray/triangle test, Woop, Benthin and Wald 2013
+// https://jcgt.org/published/0002/01/05/paper.pdf
+// The vertices are sheared into the ray's space where the ray points along +z,
+// then the 2D edge functions decide. Edges shared by two triangles compute the
+// same edge function, so rays can't slip between them.
+
+// Per ray shear, kz is the dominant axis of D
+struct RayShear
+{
+    uint32_t kx, ky, kz;
+    float Sx, Sy, Sz;
+
+    RayShear() {}
+    explicit RayShear(const float3& D)
+    {
+        float3 absD = abs( D );
+        kz = (absD.x > absD.y) ? (absD.x > absD.z ? 0 : 2) : (absD.y > absD.z ? 1 : 2);
+        kx = kz == 2 ? 0 : kz + 1;
+        ky = kx == 2 ? 0 : kx + 1;
+
+        // keep the winding
+        if (D[kz] < 0.0f)
+            std::swap(kx, ky);
+
+        Sx = D[kx] / D[kz];
+        Sy = D[ky] / D[kz];
+        Sz = 1.0f / D[kz];
+    }
+};
+
+// Hit in (tMin, tMax) of the ray at O against v0 v1 v2. outU and outV are the barycentrics of v1 and v2.
+inline bool intersectRayTriWatertight(const float3& O, const RayShear& shear, const float3& v0, const float3& v1, const float3& v2,
+    float tMin, float tMax, float& outT, float& outU, float& outV)
+{
+    const float3 A = v0 - O;
+    const float3 B = v1 - O;
+    const float3 C = v2 - O;
+
+    const float Ax = A[shear.kx] - shear.Sx * A[shear.kz];
+    const float Ay = A[shear.ky] - shear.Sy * A[shear.kz];
+    const float Bx = B[shear.kx] - shear.Sx * B[shear.kz];
+    const float By = B[shear.ky] - shear.Sy * B[shear.kz];
+    const float Cx = C[shear.kx] - shear.Sx * C[shear.kz];
+    const float Cy = C[shear.ky] - shear.Sy * C[shear.kz];
+
+    float U = Cx * By - Cy * Bx;
+    float V = Ax * Cy - Ay * Cx;
+    float W = Bx * Ay - By * Ax;
+
+    // the ray passes exactly through an edge or vertex, float can't tell which side
+    if (U == 0.0f || V == 0.0f || W == 0.0f)
+    {
+        U = float(double(Cx) * double(By) - double(Cy) * double(Bx));
+        V = float(double(Ax) * double(Cy) - double(Ay) * double(Cx));
+        W = float(double(Bx) * double(Ay) - double(By) * double(Ax));
+    }
+
+    if ((U < 0.0f || V < 0.0f || W < 0.0f) && (U > 0.0f || V > 0.0f || W > 0.0f)) return false;
+
+    const float det = U + V + W;
+    if (det == 0.0f) return false;  // ray in the triangle's plane
+
+    const float Az = shear.Sz * A[shear.kz];
+    const float Bz = shear.Sz * B[shear.kz];
+    const float Cz = shear.Sz * C[shear.kz];
+    const float T = U * Az + V * Bz + W * Cz;
+
+    // compare t = T / det against the range without dividing
+    const float sign = det < 0.0f ? -1.0f : 1.0f;
+    const float absDet = det * sign;
+    if (T * sign <= tMin * absDet || T * sign >= tMax * absDet) return false;
+
+    const float rcpDet = 1.0f / det;
+    outT = T * rcpDet;
+    outU = V * rcpDet;
+    outV = W * rcpDet;
+    return true;
+}
+
+// ray.hit is only written for a closer hit, primId identifies tri in it.
+inline void intersectRayTriWatertight(Ray& ray, const RayShear& shear, const Tri& tri, uint32_t primId, const float kTMin = 0.0001f)
+{
+    float t, u, v;
+    if (intersectRayTriWatertight(ray.O, shear, tri.vertex0, tri.vertex1, tri.vertex2, kTMin, ray.hit.t, t, u, v))
+    {
+        ray.hit.t = t;
+        ray.hit.u = u;
+        ray.hit.v = v;
+        ray.hit.primId = primId;
+    }
+}
+
+inline bool occludeRayTriWatertight(const Ray& ray, const RayShear& shear, const Tri& tri, const float kTMin = 0.0001f)
+{
+    float t, u, v;
+    return intersectRayTriWatertight(ray.O, shear, tri.vertex0, tri.vertex1, tri.vertex2, kTMin, ray.hit.t, t, u, v);
+}
+
+// Slab distances are rounded, a ray through a box's edge or corner can come
+// out with tmax a few ulps below tmin and skip the box. Scaling tmax by
+// 1 + 2 * gamma(3) keeps the test conservative, Ize 2013, Robust BVH Ray Traversal.
+// https://jcgt.org/published/0002/02/02/paper.pdf
+constexpr float kAabbRobustScale = 1.0f + 2.0f * (3.0f * 0x1p-24f) / (1.0f - 3.0f * 0x1p-24f);
+
 // if result == kInf then it misses intersection
 inline float intersectRayAabb(const Ray& ray, const float3 bmin, const float3 bmax)
 {
-    float tx1 = (bmin.x - ray.O.x) / ray.D.x, tx2 = (bmax.x - ray.O.x) / ray.D.x;
+    float tx1 = (bmin.x - ray.O.x) * ray.rD.x, tx2 = (bmax.x - ray.O.x) * ray.rD.x;
     float tmin = min( tx1, tx2 ), tmax = max( tx1, tx2 );
-    float ty1 = (bmin.y - ray.O.y) / ray.D.y, ty2 = (bmax.y - ray.O.y) / ray.D.y;
+    float ty1 = (bmin.y - ray.O.y) * ray.rD.y, ty2 = (bmax.y - ray.O.y) * ray.rD.y;
+    tmin = max( tmin, min( ty1, ty2 ) ), tmax = min( tmax, max( ty1, ty2 ) );
+    float tz1 = (bmin.z - ray.O.z) * ray.rD.z, tz2 = (bmax.z - ray.O.z) * ray.rD.z;
+    tmin = max( tmin, min( tz1, tz2 ) ), tmax = min( tmax, max( tz1, tz2 ) );
+    tmax *= kAabbRobustScale;
+    return (tmax >= tmin && tmin < ray.hit.t && tmax > 0) ? tmin : Ray::kInf;
+}
+
+// Ray broadcast to all SIMD lanes, set up once per traversal
+struct RaySimd4
+{
+    simd4f O[3];
+    simd4f D[3];
+    simd4f rD[3];
+
+    // for the watertight kernels, left unset unless asked for as the shear costs 3 divisions
+    RayShear shear;
+    simd4f S[3];
+
+    RaySimd4(const Ray& ray, bool watertight)
+        : O{ ray.O.x, ray.O.y, ray.O.z }
+        , D{ ray.D.x, ray.D.y, ray.D.z }
+        , rD{ ray.rD.x, ray.rD.y, ray.rD.z }
+    {
+        if (watertight)
+        {
+            shear = RayShear(ray.D);
+            S[0] = simd4f(shear.Sx);
+            S[1] = simd4f(shear.Sy);
+            S[2] = simd4f(shear.Sz);
+        }
+    }
+};
+
+// Slab test of one ray against 4 boxes in SoA layout (bmin[axis] holds that axis for the 4 boxes).
+// Returns the entry distance per lane, kInf for lanes that miss or are farther than ray.hit.t.
+inline simd4f intersectRayAabb4(const RaySimd4& ray4, float rayT, const simd4f bmin[3], const simd4f bmax[3])
+{
+    simd4f tx1 = (bmin[0] - ray4.O[0]) * ray4.rD[0], tx2 = (bmax[0] - ray4.O[0]) * ray4.rD[0];
+    simd4f tmin = min( tx1, tx2 ), tmax = max( tx1, tx2 );
+    simd4f ty1 = (bmin[1] - ray4.O[1]) * ray4.rD[1], ty2 = (bmax[1] - ray4.O[1]) * ray4.rD[1];
     tmin = max( tmin, min( ty1, ty2 ) ), tmax = min( tmax, max( ty1, ty2 ) );
-    float tz1 = (bmin.z - ray.O.z) / ray.D.z, tz2 = (bmax.z - ray.O.z) / ray.D.z;
+    simd4f tz1 = (bmin[2] - ray4.O[2]) * ray4.rD[2], tz2 = (bmax[2] - ray4.O[2]) * ray4.rD[2];
     tmin = max( tmin, min( tz1, tz2 ) ), tmax = min( tmax, max( tz1, tz2 ) );
-    return (tmax >= tmin && tmin < ray.t && tmax > 0) ? tmin : Ray::kInf;
+    tmax = tmax * simd4f(kAabbRobustScale);
+    simd4b hit = (tmax >= tmin) & (tmin < simd4f(rayT)) & (tmax > simd4f(0.0f));
+    return select( hit, tmin, simd4f(Ray::kInf) );
+}
+
+// Möller-Trumbore of one ray against the 4 triangles of a block, lanes outside
+// of laneMask are ignored. Returns the lanes hit in (kEpsilon, rayT), outT/outU/outV
+// hold their distances and barycentrics.
+inline int intersectRayTriBlock4(const RaySimd4& ray4, float rayT, const TriBlock4& block, int laneMask,
+    simd4f& outT, simd4f& outU, simd4f& outV, const float kEpsilon = 0.0001f)
+{
+    simd4f e1x = simd4f::load(block.edge1[0]), e1y = simd4f::load(block.edge1[1]), e1z = simd4f::load(block.edge1[2]);
+    simd4f e2x = simd4f::load(block.edge2[0]), e2y = simd4f::load(block.edge2[1]), e2z = simd4f::load(block.edge2[2]);
+    const simd4f* D = ray4.D;
+
+    // h = cross( ray.D, edge2 )
+    simd4f hx = D[1] * e2z - D[2] * e2y;
+    simd4f hy = D[2] * e2x - D[0] * e2z;
+    simd4f hz = D[0] * e2y - D[1] * e2x;
+    simd4f a = e1x * hx + e1y * hy + e1z * hz;
+    simd4b mask = simd4b::fromMask(laneMask) & ((a <= simd4f(-kEpsilon)) | (a >= simd4f(kEpsilon)));   // ray parallel to triangle
+    if (!mask.any())
+        return 0;
+
+    simd4f f = simd4f(1.0f) / a;
+    simd4f sx = ray4.O[0] - simd4f::load(block.vertex0[0]);
+    simd4f sy = ray4.O[1] - simd4f::load(block.vertex0[1]);
+    simd4f sz = ray4.O[2] - simd4f::load(block.vertex0[2]);
+    simd4f u = f * (sx * hx + sy * hy + sz * hz);
+
+    // q = cross( s, edge1 )
+    simd4f qx = sy * e1z - sz * e1y;
+    simd4f qy = sz * e1x - sx * e1z;
+    simd4f qz = sx * e1y - sy * e1x;
+    simd4f v = f * (D[0] * qx + D[1] * qy + D[2] * qz);
+    simd4f t = f * (e2x * qx + e2y * qy + e2z * qz);
+
+    mask = mask & (u >= simd4f(0.0f)) & (v >= simd4f(0.0f)) & (u + v <= simd4f(1.0f)) & (t > simd4f(kEpsilon)) & (t < simd4f(rayT));
+    outT = t;
+    outU = u;
+    outV = v;
+    return mask.mask();
+}
+
+// Watertight test of one ray against the 4 triangles of a vertex block, see
+// intersectRayTriWatertight(). Returns the lanes hit in (kTMin, rayT).
+inline int intersectRayTriBlock4(const RaySimd4& ray4, float rayT, const TriVertexBlock4& block, int laneMask,
+    simd4f& outT, simd4f& outU, simd4f& outV, const float kTMin = 0.0001f)
+{
+    const uint32_t kx = ray4.shear.kx, ky = ray4.shear.ky, kz = ray4.shear.kz;
+
+    // sheared 2D vertices relative to the ray origin
+    simd4f x[3], y[3], z[3];
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        simd4f vz = simd4f::load(block.vertex[i][kz]) - ray4.O[kz];
+        x[i] = (simd4f::load(block.vertex[i][kx]) - ray4.O[kx]) - ray4.S[0] * vz;
+        y[i] = (simd4f::load(block.vertex[i][ky]) - ray4.O[ky]) - ray4.S[1] * vz;
+        z[i] = ray4.S[2] * vz;
+    }
+
+    simd4f U = x[2] * y[1] - y[2] * x[1];
+    simd4f V = x[0] * y[2] - y[0] * x[2];
+    simd4f W = x[1] * y[0] - y[1] * x[0];
+
+    simd4f zero(0.0f);
+    simd4b active = simd4b::fromMask(laneMask);
+    simd4b inside = ((U >= zero) & (V >= zero) & (W >= zero)) | ((U <= zero) & (V <= zero) & (W <= zero));
+    int hitMask = (active & inside).mask();
+
+    // lanes exactly on an edge are redone in double precision by the scalar kernel
+    simd4b onEdge = active & (((U >= zero) & (U <= zero)) | ((V >= zero) & (V <= zero)) | ((W >= zero) & (W <= zero)));
+    int onEdgeMask = onEdge.mask();
+    if (!hitMask && !onEdgeMask)
+        return 0;
+
+    simd4f det = U + V + W;
+    simd4f T = U * z[0] + V * z[1] + W * z[2];
+    simd4b negative = det < zero;
+    simd4f absDet = select(negative, zero - det, det);
+    simd4f signedT = select(negative, zero - T, T);
+    simd4b inRange = (signedT > simd4f(kTMin) * absDet) & (signedT < simd4f(rayT) * absDet) & (absDet > zero);
+    hitMask &= inRange.mask();
+
+    simd4f rcpDet = simd4f(1.0f) / det;
+    outT = T * rcpDet;
+    outU = V * rcpDet;
+    outV = W * rcpDet;
+
+    if (onEdgeMask)
+    {
+        const float3 O( ray4.O[0][0], ray4.O[1][0], ray4.O[2][0] );
+        float t[4], u[4], v[4];
+        outT.store(t);
+        outU.store(u);
+        outV.store(v);
+        for (uint32_t lane = 0; lane < 4; lane++)
+        {
+            if (!(onEdgeMask & (1 << lane)))
+                continue;
+
+            float3 v0( block.vertex[0][0][lane], block.vertex[0][1][lane], block.vertex[0][2][lane] );
+            float3 v1( block.vertex[1][0][lane], block.vertex[1][1][lane], block.vertex[1][2][lane] );
+            float3 v2( block.vertex[2][0][lane], block.vertex[2][1][lane], block.vertex[2][2][lane] );
+            if (intersectRayTriWatertight(O, ray4.shear, v0, v1, v2, kTMin, rayT, t[lane], u[lane], v[lane]))
+                hitMask |= 1 << lane;
+            else
+                hitMask &= ~(1 << lane);
+        }
+        outT = simd4f::load(t);
+        outU = simd4f::load(u);
+        outV = simd4f::load(v);
+    }
+
+    return hitMask;
+}
+
+// Lanes of block blockIndex within items [first, end), the first and last block of a leaf can be shared with other leaves
+inline int computeBlockLaneMask(uint32_t blockIndex, uint32_t first, uint32_t end)
+{
+    uint32_t blockFirst = blockIndex * 4;
+    uint32_t laneBegin = first > blockFirst ? first - blockFirst : 0;
+    uint32_t laneEnd = std::min(end - blockFirst, 4u);
+    return (0xf >> (4 - laneEnd)) & (0xf << laneBegin);
+}
+
+// Closest hit of the triangle blocks covering items [first, first + count) in block order,
+// Block is TriBlock4 or TriVertexBlock4.
+template <typename Block>
+inline void intersectRayTriBlocks(Ray& ray, const RaySimd4& ray4, const Block* blocks, uint32_t first, uint32_t count)
+{
+    const uint32_t end = first + count;
+    for (uint32_t blockIndex = first / 4; blockIndex * 4 < end; blockIndex++)
+    {
+        simd4f t4, u4, v4;
+        int hitMask = intersectRayTriBlock4(ray4, ray.hit.t, blocks[blockIndex], computeBlockLaneMask(blockIndex, first, end), t4, u4, v4);
+        if (hitMask == 0)
+            continue;
+
+        float t[4];
+        t4.store(t);
+        for (uint32_t lane = 0; lane < 4; lane++)
+        {
+            if ((hitMask & (1 << lane)) && t[lane] < ray.hit.t)
+            {
+                ray.hit.t = t[lane];
+                ray.hit.u = u4[lane];
+                ray.hit.v = v4[lane];
+                ray.hit.primId = blocks[blockIndex].primId[lane];
+            }
+        }
+    }
+}
+
+// Any-hit version of intersectRayTriBlocks.
+template <typename Block>
+inline bool occludeRayTriBlocks(const Ray& ray, const RaySimd4& ray4, const Block* blocks, uint32_t first, uint32_t count)
+{
+    const uint32_t end = first + count;
+    for (uint32_t blockIndex = first / 4; blockIndex * 4 < end; blockIndex++)
+    {
+        simd4f t4, u4, v4;
+        if (intersectRayTriBlock4(ray4, ray.hit.t, blocks[blockIndex], computeBlockLaneMask(blockIndex, first, end), t4, u4, v4))
+            return true;
+    }
+    return false;
 }
 
-} // namespace Math
\ No newline at end of file
+} // namespace Math
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "Vector.h"
+#include <cstdint>
+
+namespace Math
+{
+
+// https://developer.nvidia.com/blog/thinking-parallel-part-iii-tree-construction-gpu/
+
+// Inserts two zero bits after each of the 10 low bits of v.
+inline uint32_t expandBits10(uint32_t v)
+{
+    v &= 0x3ff;
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+// Inserts two zero bits after each of the 21 low bits of v.
+inline uint64_t expandBits21(uint64_t v)
+{
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffull;
+    v = (v | v << 16) & 0x1f0000ff0000ffull;
+    v = (v | v << 8)  & 0x100f00f00f00f00full;
+    v = (v | v << 4)  & 0x10c30c30c30c30c3ull;
+    v = (v | v << 2)  & 0x1249249249249249ull;
+    return v;
+}
+
+// 30-bit Morton code for p in [0, 1]^3
+inline uint32_t morton30(const float3& p)
+{
+    float3 q = clamp(p * 1024.0f, float3(0.0f), float3(1023.0f));
+    return (expandBits10(uint32_t(q.x)) << 2) | (expandBits10(uint32_t(q.y)) << 1) | expandBits10(uint32_t(q.z));
+}
+
+// 63-bit Morton code for p in [0, 1]^3
+inline uint64_t morton63(const float3& p)
+{
+    float3 q = clamp(p * 2097152.0f, float3(0.0f), float3(2097151.0f));
+    return (expandBits21(uint64_t(q.x)) << 2) | (expandBits21(uint64_t(q.y)) << 1) | expandBits21(uint64_t(q.z));
+}
+
+} // namespace Math
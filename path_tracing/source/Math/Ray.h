@@ -1,16 +1,49 @@
 #pragma once
 
 #include "Vector.h"
+#include <cstdint>
 
 namespace Math
 {
-    struct Ray
+    // Closest hit found so far. Traversal only writes it when a closer hit is
+    // found, shading reads the primitive back from primId.
+    struct Hit
     {
         static constexpr float kInf = 1e30f;
+        static constexpr uint32_t kInvalidId = ~0u;
+
+        float t = Hit::kInf;
+        float u = 0.0f;                 // barycentrics of vertex1 and vertex2
+        float v = 0.0f;
+        uint32_t primId = kInvalidId;   // item index
+        uint32_t instId = kInvalidId;   // instance index, if traced through instances
+
+        bool isValid() const { return primId != kInvalidId; }
+    };
+
+    struct Ray
+    {
+        static constexpr float kInf = Hit::kInf;
 
         Math::float3 O;
         Math::float3 D;
-        float t = Ray::kInf;
+        Math::float3 rD;    // 1 / D, slab tests multiply instead of divide
+        Hit hit;            // hit.t is the max distance on input
+
+        // at the origin along +z, for slots the renderer fills in later
+        Ray() : Ray(Math::float3( 0.0f ), Math::float3( 0.0f, 0.0f, 1.0f )) {}
+        Ray(const Math::float3& O, const Math::float3& D, float t = Ray::kInf)
+            : O(O), D(D), rD(1.0f / D.x, 1.0f / D.y, 1.0f / D.z)
+        {
+            hit.t = t;
+        }
+
+        // D and rD are only written together, write D through here
+        void setDirection(const Math::float3& newD)
+        {
+            D = newD;
+            rD = Math::float3( 1.0f / newD.x, 1.0f / newD.y, 1.0f / newD.z );
+        }
     };
 
-} // namespace Math
\ No newline at end of file
+} // namespace Math
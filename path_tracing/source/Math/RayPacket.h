@@ -0,0 +1,153 @@
+#pragma once
+
+#include "Intersect.h"
+#include "Ray.h"
+#include "Simd.h"
+#include "Tri.h"
+
+namespace Math
+{
+
+// N coherent rays in SoA layout, the kernels below process them 4 lanes at a time.
+template <uint32_t N>
+struct RayPacket
+{
+    static_assert(N % 4 == 0 && N <= 32);
+    static constexpr uint32_t kSize = N;
+    static constexpr uint32_t kGroupCount = N / 4;
+    static constexpr uint32_t kAllLanes = (N == 32) ? ~0u : ((1u << N) - 1);
+
+    float O[3][N];
+    float D[3][N];
+    float rD[3][N];
+
+    // hit record, as in Hit, written for closer hits only
+    float t[N];
+    float u[N];
+    float v[N];
+    uint32_t primId[N];
+
+    void setRay(uint32_t lane, const Ray& ray)
+    {
+        for (uint32_t axis = 0; axis < 3; axis++)
+        {
+            O[axis][lane] = ray.O[axis];
+            D[axis][lane] = ray.D[axis];
+            rD[axis][lane] = ray.rD[axis];
+        }
+        t[lane] = ray.hit.t;
+        u[lane] = 0.0f;
+        v[lane] = 0.0f;
+        primId[lane] = Hit::kInvalidId;
+    }
+
+    Hit getHit(uint32_t lane) const
+    {
+        Hit hit;
+        hit.t = t[lane];
+        hit.u = u[lane];
+        hit.v = v[lane];
+        hit.primId = primId[lane];
+        return hit;
+    }
+};
+
+using RayPacket4 = RayPacket<4>;
+using RayPacket8 = RayPacket<8>;
+using RayPacket16 = RayPacket<16>;
+
+// Slab test of the 4 rays of a packet lane group against one box.
+// Returns the 4 bit hit mask, outDist holds the entry distance per lane.
+template <uint32_t N>
+inline int intersectPacketAabb4(const RayPacket<N>& packet, uint32_t group, const float3& bmin, const float3& bmax, simd4f& outDist)
+{
+    const uint32_t lane = group * 4;
+    simd4f tmin, tmax;
+    for (uint32_t axis = 0; axis < 3; axis++)
+    {
+        simd4f O = simd4f::load(&packet.O[axis][lane]);
+        simd4f rD = simd4f::load(&packet.rD[axis][lane]);
+        simd4f t1 = (simd4f(bmin[axis]) - O) * rD;
+        simd4f t2 = (simd4f(bmax[axis]) - O) * rD;
+        if (axis == 0)
+        {
+            tmin = min( t1, t2 ), tmax = max( t1, t2 );
+        }
+        else
+        {
+            tmin = max( tmin, min( t1, t2 ) ), tmax = min( tmax, max( t1, t2 ) );
+        }
+    }
+    outDist = tmin;
+    tmax = tmax * simd4f(kAabbRobustScale);
+    simd4b hit = (tmax >= tmin) & (tmin < simd4f::load(&packet.t[lane])) & (tmax > simd4f(0.0f));
+    return hit.mask();
+}
+
+// Möller-Trumbore of the 4 rays of a packet lane group against one triangle,
+// only the lanes set in laneMask are updated.
+template <uint32_t N>
+inline void intersectPacketTri4(RayPacket<N>& packet, uint32_t group, int laneMask, const float3& vertex0, const float3& edge1, const float3& edge2, uint32_t primId, const float kEpsilon = 0.0001f)
+{
+    const uint32_t lane = group * 4;
+
+    simd4f Dx = simd4f::load(&packet.D[0][lane]), Dy = simd4f::load(&packet.D[1][lane]), Dz = simd4f::load(&packet.D[2][lane]);
+
+    // h = cross( ray.D, edge2 )
+    simd4f hx = Dy * simd4f(edge2.z) - Dz * simd4f(edge2.y);
+    simd4f hy = Dz * simd4f(edge2.x) - Dx * simd4f(edge2.z);
+    simd4f hz = Dx * simd4f(edge2.y) - Dy * simd4f(edge2.x);
+    simd4f a = simd4f(edge1.x) * hx + simd4f(edge1.y) * hy + simd4f(edge1.z) * hz;
+    simd4b mask = simd4b::fromMask(laneMask) & ((a <= simd4f(-kEpsilon)) | (a >= simd4f(kEpsilon)));   // ray parallel to triangle
+    if (!mask.any())
+        return;
+
+    simd4f f = simd4f(1.0f) / a;
+    simd4f sx = simd4f::load(&packet.O[0][lane]) - simd4f(vertex0.x);
+    simd4f sy = simd4f::load(&packet.O[1][lane]) - simd4f(vertex0.y);
+    simd4f sz = simd4f::load(&packet.O[2][lane]) - simd4f(vertex0.z);
+    simd4f u = f * (sx * hx + sy * hy + sz * hz);
+    mask = mask & (u >= simd4f(0.0f)) & (u <= simd4f(1.0f));
+    if (!mask.any())
+        return;
+
+    // q = cross( s, edge1 )
+    simd4f qx = sy * simd4f(edge1.z) - sz * simd4f(edge1.y);
+    simd4f qy = sz * simd4f(edge1.x) - sx * simd4f(edge1.z);
+    simd4f qz = sx * simd4f(edge1.y) - sy * simd4f(edge1.x);
+    simd4f v = f * (Dx * qx + Dy * qy + Dz * qz);
+    simd4f t = f * (simd4f(edge2.x) * qx + simd4f(edge2.y) * qy + simd4f(edge2.z) * qz);
+
+    simd4f rayT = simd4f::load(&packet.t[lane]);
+    mask = mask & (v >= simd4f(0.0f)) & (u + v <= simd4f(1.0f)) & (t > simd4f(kEpsilon)) & (t < rayT);
+    int hitMask = mask.mask();
+    if (hitMask == 0)
+        return;
+
+    select(mask, t, rayT).store(&packet.t[lane]);
+    select(mask, u, simd4f::load(&packet.u[lane])).store(&packet.u[lane]);
+    select(mask, v, simd4f::load(&packet.v[lane])).store(&packet.v[lane]);
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        if (hitMask & (1 << i))
+            packet.primId[lane + i] = primId;
+    }
+}
+
+template <uint32_t N>
+inline void intersectPacketTri4(RayPacket<N>& packet, uint32_t group, int laneMask, const Tri& tri, uint32_t primId, const float kEpsilon = 0.0001f)
+{
+    intersectPacketTri4(packet, group, laneMask, tri.vertex0, tri.vertex1 - tri.vertex0, tri.vertex2 - tri.vertex0, primId, kEpsilon);
+}
+
+// Same against the triangle in lane blockLane of a block, edges are precomputed there.
+template <uint32_t N>
+inline void intersectPacketTri4(RayPacket<N>& packet, uint32_t group, int laneMask, const TriBlock4& block, uint32_t blockLane, const float kEpsilon = 0.0001f)
+{
+    const float3 vertex0(block.vertex0[0][blockLane], block.vertex0[1][blockLane], block.vertex0[2][blockLane]);
+    const float3 edge1(block.edge1[0][blockLane], block.edge1[1][blockLane], block.edge1[2][blockLane]);
+    const float3 edge2(block.edge2[0][blockLane], block.edge2[1][blockLane], block.edge2[2][blockLane]);
+    intersectPacketTri4(packet, group, laneMask, vertex0, edge1, edge2, block.primId[blockLane], kEpsilon);
+}
+
+} // namespace Math
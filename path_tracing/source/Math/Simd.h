@@ -0,0 +1,191 @@
+#pragma once
+
+// Minimal 4-wide float SIMD wrapper: SSE on x86, NEON on ARM, plain arrays
+// elsewhere. Only what the intersection kernels need.
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define MATH_SIMD_SSE
+    #include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+    #define MATH_SIMD_NEON
+    #include <arm_neon.h>
+#else
+    #define MATH_SIMD_SCALAR
+#endif
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace Math
+{
+
+///////////////////////////////////////////////////////////////////////////////
+// simd4b: per lane mask, all bits set or cleared
+///////////////////////////////////////////////////////////////////////////////
+
+struct simd4b
+{
+#if defined(MATH_SIMD_SSE)
+    __m128 v;
+#elif defined(MATH_SIMD_NEON)
+    uint32x4_t v;
+#else
+    uint32_t v[4];
+#endif
+
+    // bit i is set when lane i is true
+    int mask() const
+    {
+    #if defined(MATH_SIMD_SSE)
+        return _mm_movemask_ps(v);
+    #elif defined(MATH_SIMD_NEON)
+        static const int32x4_t kShift = { 0, 1, 2, 3 };
+        return int(vaddvq_u32(vshlq_u32(vshrq_n_u32(v, 31), kShift)));
+    #else
+        return int((v[0] & 1) | (v[1] & 1) << 1 | (v[2] & 1) << 2 | (v[3] & 1) << 3);
+    #endif
+    }
+
+    bool any() const { return mask() != 0; }
+    bool all() const { return mask() == 0xf; }
+
+    // lane i is true when bit i is set
+    static simd4b fromMask(int mask)
+    {
+    #if defined(MATH_SIMD_SSE)
+        const __m128i kBits = _mm_setr_epi32(1, 2, 4, 8);
+        return { _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(mask), kBits), kBits)) };
+    #elif defined(MATH_SIMD_NEON)
+        static const uint32x4_t kBits = { 1, 2, 4, 8 };
+        return { vtstq_u32(vdupq_n_u32(uint32_t(mask)), kBits) };
+    #else
+        return { { (mask & 1) ? ~0u : 0u, (mask & 2) ? ~0u : 0u, (mask & 4) ? ~0u : 0u, (mask & 8) ? ~0u : 0u } };
+    #endif
+    }
+};
+
+inline simd4b operator&(const simd4b& a, const simd4b& b)
+{
+#if defined(MATH_SIMD_SSE)
+    return { _mm_and_ps(a.v, b.v) };
+#elif defined(MATH_SIMD_NEON)
+    return { vandq_u32(a.v, b.v) };
+#else
+    return { { a.v[0] & b.v[0], a.v[1] & b.v[1], a.v[2] & b.v[2], a.v[3] & b.v[3] } };
+#endif
+}
+
+inline simd4b operator|(const simd4b& a, const simd4b& b)
+{
+#if defined(MATH_SIMD_SSE)
+    return { _mm_or_ps(a.v, b.v) };
+#elif defined(MATH_SIMD_NEON)
+    return { vorrq_u32(a.v, b.v) };
+#else
+    return { { a.v[0] | b.v[0], a.v[1] | b.v[1], a.v[2] | b.v[2], a.v[3] | b.v[3] } };
+#endif
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// simd4f
+///////////////////////////////////////////////////////////////////////////////
+
+// load() of 8 or 16-bit unsigned integers converts them to floats
+struct simd4f
+{
+#if defined(MATH_SIMD_SSE)
+    __m128 v;
+    simd4f() {}
+    simd4f(__m128 v) : v(v) {}
+    simd4f(float f) : v(_mm_set1_ps(f)) {}
+    simd4f(float f0, float f1, float f2, float f3) : v(_mm_setr_ps(f0, f1, f2, f3)) {}
+
+    static simd4f load(const float* p) { return _mm_loadu_ps(p); }
+    static simd4f load(const uint8_t* p) { int32_t i; std::memcpy(&i, p, 4); __m128i z = _mm_setzero_si128(); return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(i), z), z)); }
+    static simd4f load(const uint16_t* p) { return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)p), _mm_setzero_si128())); }
+    void store(float* p) const { _mm_storeu_ps(p, v); }
+#elif defined(MATH_SIMD_NEON)
+    float32x4_t v;
+    simd4f() {}
+    simd4f(float32x4_t v) : v(v) {}
+    simd4f(float f) : v(vdupq_n_f32(f)) {}
+    simd4f(float f0, float f1, float f2, float f3) : v{ f0, f1, f2, f3 } {}
+
+    static simd4f load(const float* p) { return vld1q_f32(p); }
+    static simd4f load(const uint8_t* p) { uint32_t i; std::memcpy(&i, p, 4); return vcvtq_f32_u32(vmovl_u16(vget_low_u16(vmovl_u8(vcreate_u8(i))))); }
+    static simd4f load(const uint16_t* p) { return vcvtq_f32_u32(vmovl_u16(vld1_u16(p))); }
+    void store(float* p) const { vst1q_f32(p, v); }
+#else
+    float v[4];
+    simd4f() {}
+    simd4f(float f) : v{ f, f, f, f } {}
+    simd4f(float f0, float f1, float f2, float f3) : v{ f0, f1, f2, f3 } {}
+
+    static simd4f load(const float* p) { return simd4f(p[0], p[1], p[2], p[3]); }
+    static simd4f load(const uint8_t* p) { return simd4f(p[0], p[1], p[2], p[3]); }
+    static simd4f load(const uint16_t* p) { return simd4f(p[0], p[1], p[2], p[3]); }
+    void store(float* p) const { p[0] = v[0]; p[1] = v[1]; p[2] = v[2]; p[3] = v[3]; }
+#endif
+
+    float operator[](int i) const { float f[4]; store(f); return f[i]; }
+};
+
+#if defined(MATH_SIMD_SSE)
+    inline simd4f operator+(const simd4f& a, const simd4f& b) { return _mm_add_ps(a.v, b.v); }
+    inline simd4f operator-(const simd4f& a, const simd4f& b) { return _mm_sub_ps(a.v, b.v); }
+    inline simd4f operator*(const simd4f& a, const simd4f& b) { return _mm_mul_ps(a.v, b.v); }
+    inline simd4f operator/(const simd4f& a, const simd4f& b) { return _mm_div_ps(a.v, b.v); }
+    inline simd4f min(const simd4f& a, const simd4f& b) { return _mm_min_ps(a.v, b.v); }
+    inline simd4f max(const simd4f& a, const simd4f& b) { return _mm_max_ps(a.v, b.v); }
+    inline simd4f sqrt(const simd4f& a) { return _mm_sqrt_ps(a.v); }
+
+    inline simd4b operator< (const simd4f& a, const simd4f& b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+    inline simd4b operator<=(const simd4f& a, const simd4f& b) { return { _mm_cmple_ps(a.v, b.v) }; }
+    inline simd4b operator> (const simd4f& a, const simd4f& b) { return { _mm_cmpgt_ps(a.v, b.v) }; }
+    inline simd4b operator>=(const simd4f& a, const simd4f& b) { return { _mm_cmpge_ps(a.v, b.v) }; }
+
+    // mask ? a : b
+    inline simd4f select(const simd4b& mask, const simd4f& a, const simd4f& b) { return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); }
+#elif defined(MATH_SIMD_NEON)
+    inline simd4f operator+(const simd4f& a, const simd4f& b) { return vaddq_f32(a.v, b.v); }
+    inline simd4f operator-(const simd4f& a, const simd4f& b) { return vsubq_f32(a.v, b.v); }
+    inline simd4f operator*(const simd4f& a, const simd4f& b) { return vmulq_f32(a.v, b.v); }
+    inline simd4f operator/(const simd4f& a, const simd4f& b) { return vdivq_f32(a.v, b.v); }
+    inline simd4f min(const simd4f& a, const simd4f& b) { return vminq_f32(a.v, b.v); }
+    inline simd4f max(const simd4f& a, const simd4f& b) { return vmaxq_f32(a.v, b.v); }
+    inline simd4f sqrt(const simd4f& a) { return vsqrtq_f32(a.v); }
+
+    inline simd4b operator< (const simd4f& a, const simd4f& b) { return { vcltq_f32(a.v, b.v) }; }
+    inline simd4b operator<=(const simd4f& a, const simd4f& b) { return { vcleq_f32(a.v, b.v) }; }
+    inline simd4b operator> (const simd4f& a, const simd4f& b) { return { vcgtq_f32(a.v, b.v) }; }
+    inline simd4b operator>=(const simd4f& a, const simd4f& b) { return { vcgeq_f32(a.v, b.v) }; }
+
+    // mask ? a : b
+    inline simd4f select(const simd4b& mask, const simd4f& a, const simd4f& b) { return vbslq_f32(mask.v, a.v, b.v); }
+#else
+    #define SIMD4_LANEWISE(expr) simd4f r; for (int i=0; i<4; i++) r.v[i] = (expr); return r
+    #define SIMD4_MASKWISE(expr) simd4b r; for (int i=0; i<4; i++) r.v[i] = (expr) ? ~0u : 0u; return r
+
+    inline simd4f operator+(const simd4f& a, const simd4f& b) { SIMD4_LANEWISE(a.v[i] + b.v[i]); }
+    inline simd4f operator-(const simd4f& a, const simd4f& b) { SIMD4_LANEWISE(a.v[i] - b.v[i]); }
+    inline simd4f operator*(const simd4f& a, const simd4f& b) { SIMD4_LANEWISE(a.v[i] * b.v[i]); }
+    inline simd4f operator/(const simd4f& a, const simd4f& b) { SIMD4_LANEWISE(a.v[i] / b.v[i]); }
+    inline simd4f min(const simd4f& a, const simd4f& b) { SIMD4_LANEWISE(a.v[i] < b.v[i] ? a.v[i] : b.v[i]); }
+    inline simd4f max(const simd4f& a, const simd4f& b) { SIMD4_LANEWISE(a.v[i] > b.v[i] ? a.v[i] : b.v[i]); }
+    inline simd4f sqrt(const simd4f& a) { SIMD4_LANEWISE(std::sqrt(a.v[i])); }
+
+    inline simd4b operator< (const simd4f& a, const simd4f& b) { SIMD4_MASKWISE(a.v[i] <  b.v[i]); }
+    inline simd4b operator<=(const simd4f& a, const simd4f& b) { SIMD4_MASKWISE(a.v[i] <= b.v[i]); }
+    inline simd4b operator> (const simd4f& a, const simd4f& b) { SIMD4_MASKWISE(a.v[i] >  b.v[i]); }
+    inline simd4b operator>=(const simd4f& a, const simd4f& b) { SIMD4_MASKWISE(a.v[i] >= b.v[i]); }
+
+    // mask ? a : b
+    inline simd4f select(const simd4b& mask, const simd4f& a, const simd4f& b) { SIMD4_LANEWISE(mask.v[i] ? a.v[i] : b.v[i]); }
+
+    #undef SIMD4_LANEWISE
+    #undef SIMD4_MASKWISE
+#endif
+
+} // namespace Math
@@ -0,0 +1,145 @@
+#pragma once
+
+#include "Aabb.h"
+#include "Vector.h"
+#include <cmath>
+
+namespace Math
+{
+
+// Affine transform as the top 3 rows of a 4x4 matrix, the last column is the
+// translation. Points are column vectors: p' = M * (p, 1).
+struct float3x4
+{
+    float m[3][4];
+
+    static float3x4 identity();
+    static float3x4 translation(const float3& t);
+    static float3x4 scale(const float3& s);
+    static float3x4 rotationY(float radians);
+
+    float3 transformPoint(const float3& p) const;
+    float3 transformVector(const float3& v) const;
+
+    // bounds of the 8 transformed corners
+    Aabb transformAabb(const Aabb& aabb) const;
+
+    // the 3x3 part has to be invertible
+    float3x4 inverse() const;
+};
+
+// applies b then a
+inline float3x4 operator*(const float3x4& a, const float3x4& b)
+{
+    float3x4 r;
+    for (int row = 0; row < 3; row++)
+    {
+        for (int col = 0; col < 4; col++)
+        {
+            r.m[row][col] = a.m[row][0] * b.m[0][col] + a.m[row][1] * b.m[1][col] + a.m[row][2] * b.m[2][col];
+            if (col == 3)
+                r.m[row][col] += a.m[row][3];
+        }
+    }
+    return r;
+}
+
+inline float3x4 float3x4::identity()
+{
+    return float3x4{ {
+        { 1.0f, 0.0f, 0.0f, 0.0f },
+        { 0.0f, 1.0f, 0.0f, 0.0f },
+        { 0.0f, 0.0f, 1.0f, 0.0f } } };
+}
+
+inline float3x4 float3x4::translation(const float3& t)
+{
+    float3x4 r = identity();
+    r.m[0][3] = t.x;
+    r.m[1][3] = t.y;
+    r.m[2][3] = t.z;
+    return r;
+}
+
+inline float3x4 float3x4::scale(const float3& s)
+{
+    float3x4 r = identity();
+    r.m[0][0] = s.x;
+    r.m[1][1] = s.y;
+    r.m[2][2] = s.z;
+    return r;
+}
+
+inline float3x4 float3x4::rotationY(float radians)
+{
+    float c = std::cos(radians);
+    float s = std::sin(radians);
+    return float3x4{ {
+        {    c, 0.0f,    s, 0.0f },
+        { 0.0f, 1.0f, 0.0f, 0.0f },
+        {   -s, 0.0f,    c, 0.0f } } };
+}
+
+inline float3 float3x4::transformPoint(const float3& p) const
+{
+    return float3(
+        m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3],
+        m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3],
+        m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3]);
+}
+
+inline float3 float3x4::transformVector(const float3& v) const
+{
+    return float3(
+        m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+        m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+        m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z);
+}
+
+// Arvo, Transforming Axis-Aligned Bounding Boxes, Graphics Gems 1990:
+// per output axis the smaller and larger product of each matrix entry
+inline Aabb float3x4::transformAabb(const Aabb& aabb) const
+{
+    Aabb r;
+    for (int row = 0; row < 3; row++)
+    {
+        r.min[row] = m[row][3];
+        r.max[row] = m[row][3];
+        for (int col = 0; col < 3; col++)
+        {
+            float a = m[row][col] * aabb.min[col];
+            float b = m[row][col] * aabb.max[col];
+            r.min[row] += a < b ? a : b;
+            r.max[row] += a < b ? b : a;
+        }
+    }
+    return r;
+}
+
+inline float3x4 float3x4::inverse() const
+{
+    // 3x3 inverse from the cofactors, the translation moves back by it
+    float c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+    float c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+    float c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+    float rcpDet = 1.0f / (m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02);
+
+    float3x4 r;
+    r.m[0][0] = c00 * rcpDet;
+    r.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * rcpDet;
+    r.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * rcpDet;
+    r.m[1][0] = c01 * rcpDet;
+    r.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * rcpDet;
+    r.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * rcpDet;
+    r.m[2][0] = c02 * rcpDet;
+    r.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * rcpDet;
+    r.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * rcpDet;
+
+    float3 t = r.transformVector(float3(m[0][3], m[1][3], m[2][3]));
+    r.m[0][3] = -t.x;
+    r.m[1][3] = -t.y;
+    r.m[2][3] = -t.z;
+    return r;
+}
+
+} // namespace Math
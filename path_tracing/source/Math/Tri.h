@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Vector.h"
+#include <cstdint>
 
 namespace Math
 {
@@ -13,4 +14,58 @@ struct Tri
     Math::float3 centroid;
 };
 
-} // namespace Math
\ No newline at end of file
+// 4 triangles in SoA layout for traversal: vertex0 and the edges are
+// precomputed, centroids are left out. Unused lanes are zero sized.
+struct TriBlock4
+{
+    float vertex0[3][4];
+    float edge1[3][4];      // vertex1 - vertex0
+    float edge2[3][4];      // vertex2 - vertex0
+    uint32_t primId[4];
+
+    void setTri(uint32_t lane, const Tri& tri, uint32_t id)
+    {
+        for (uint32_t axis = 0; axis < 3; axis++)
+        {
+            vertex0[axis][lane] = tri.vertex0[axis];
+            edge1[axis][lane] = tri.vertex1[axis] - tri.vertex0[axis];
+            edge2[axis][lane] = tri.vertex2[axis] - tri.vertex0[axis];
+        }
+        primId[lane] = id;
+    }
+};
+static_assert(sizeof(TriBlock4) == 160);
+
+// 4 triangles in SoA layout with the vertices as they are, for the watertight
+// kernel: shared edges must be computed from identical inputs.
+struct TriVertexBlock4
+{
+    float vertex[3][3][4];  // [vertex][axis][lane]
+    uint32_t primId[4];
+
+    void setTri(uint32_t lane, const Tri& tri, uint32_t id)
+    {
+        for (uint32_t axis = 0; axis < 3; axis++)
+        {
+            vertex[0][axis][lane] = tri.vertex0[axis];
+            vertex[1][axis][lane] = tri.vertex1[axis];
+            vertex[2][axis][lane] = tri.vertex2[axis];
+        }
+        primId[lane] = id;
+    }
+};
+static_assert(sizeof(TriVertexBlock4) == 160);
+
+// geometric normal, counter-clockwise winding
+inline Math::float3 computeNormal(const Tri& tri)
+{
+    return normalize( cross( tri.vertex1 - tri.vertex0, tri.vertex2 - tri.vertex0 ) );
+}
+
+// point at barycentrics u, v as in Hit
+inline Math::float3 interpolatePosition(const Tri& tri, float u, float v)
+{
+    return tri.vertex0 * (1.0f - u - v) + tri.vertex1 * u + tri.vertex2 * v;
+}
+
+} // namespace Math
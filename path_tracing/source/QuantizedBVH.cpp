@@ -0,0 +1,419 @@
+#include "QuantizedBVH.h"
+#include "WideBVH.h"
+#include "Core/Profiler.h"
+#include "Math/Aabb.h"
+#include "Math/Intersect.h"
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cmath>
+using namespace Math;
+
+///////////////////////////////////////////////////////////////////////////////
+// Profiling
+///////////////////////////////////////////////////////////////////////////////
+#ifdef BVH_ENABLE_PROFILING
+    #define IF_PROFILING(x) x
+#else
+    #define IF_PROFILING(x)
+#endif
+
+// smallest exponent of a normal float scale
+static constexpr int kMinExponent = -126;
+
+static float getScale(int8_t exponent)
+{
+    return std::bit_cast<float>(uint32_t(exponent + 127) << 23);
+}
+
+// same arithmetic as the traversal, q * scale is exact so it matches with or without FMA
+static float decode(float origin, float scale, uint32_t q)
+{
+    return origin + float(q) * scale;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Construction
+///////////////////////////////////////////////////////////////////////////////
+
+// Quantizes one axis of the child bounds, min rounded down and max rounded up
+// until the decoded values contain them. Returns false when a max doesn't fit
+// in maxQuantized steps of scale.
+template <typename Quantized>
+static bool quantizeAxis(const float* mins, const float* maxs, uint32_t count, float origin, float scale, uint32_t maxQuantized,
+    Quantized* outMins, Quantized* outMaxs)
+{
+    for (uint32_t i=0; i<count; i++)
+    {
+        float qmin = std::floor((mins[i] - origin) / scale);
+        uint32_t q = uint32_t(std::clamp(qmin, 0.0f, float(maxQuantized)));
+        while (q > 0 && decode(origin, scale, q) > mins[i])
+            q--;
+        outMins[i] = Quantized(q);
+
+        float qmax = std::ceil((maxs[i] - origin) / scale);
+        if (!(qmax <= float(maxQuantized)))
+            return false;
+        q = uint32_t(std::max(qmax, 0.0f));
+        while (decode(origin, scale, q) < maxs[i])
+        {
+            if (q == maxQuantized)
+                return false;
+            q++;
+        }
+        outMaxs[i] = Quantized(q);
+    }
+    return true;
+}
+
+// Sets the origin and exponents of the node and quantizes the child bounds.
+template <uint32_t N, uint32_t Bits>
+static void quantizeChildren(QuantizedBVHNode<N, Bits>& node, const Aabb* childBounds, uint32_t childCount)
+{
+    using Node = QuantizedBVHNode<N, Bits>;
+
+    for (uint8_t axis = 0; axis < CoordAxis_Count; axis++)
+    {
+        float mins[N] = {};
+        float maxs[N] = {};
+        for (uint32_t i=0; i<childCount; i++)
+        {
+            mins[i] = childBounds[i].min[axis];
+            maxs[i] = childBounds[i].max[axis];
+        }
+        float origin = *std::min_element(mins, mins + childCount);
+        float extent = *std::max_element(maxs, maxs + childCount) - origin;
+
+        // smallest power of two step covering the extent, one more when rounding doesn't fit
+        int exponent = kMinExponent;
+        if (extent > 0.0f)
+        {
+            exponent = std::max(kMinExponent, std::ilogb(extent / float(Node::kMaxQuantized)));
+            while (std::ldexp(float(Node::kMaxQuantized), exponent) < extent)
+                exponent++;
+        }
+        while (!quantizeAxis(mins, maxs, childCount, origin, getScale(int8_t(exponent)), Node::kMaxQuantized, node.childMin[axis], node.childMax[axis]))
+            exponent++;
+        assert(exponent <= 127);
+
+        node.origin[axis] = origin;
+        node.exponent[axis] = int8_t(exponent);
+    }
+}
+
+template <uint32_t N, uint32_t Bits>
+QuantizedBVH<N, Bits>::QuantizedBVH(const BVH& bvh)
+    : items(bvh.getItems())
+    , itemRefs(bvh.getItemRefs())
+    , triBlocks(bvh.getTriBlocks())
+    , triVertexBlocks(bvh.getTriVertexBlocks())
+    , triKernel(bvh.getBuildParams().triKernel)
+    , bounds(bvh.getBounds())
+{
+    PROFILE_ZONE("BVH quantize");
+
+    const BVH::NodePool& binaryNodes = bvh.getNodes();
+    const BVHNode& binaryRoot = binaryNodes[bvh.getRootNodeIndex()];
+
+    nodePool.reserve(binaryNodes.size() / 2 + 1);
+
+    if (binaryRoot.isLeaf())
+    {
+        uint32_t rootChild = bvh.getRootNodeIndex();
+        rootNodeIndex = collapseNode(binaryNodes, &rootChild, 1);
+    }
+    else
+    {
+        uint32_t rootChildren[2] = { binaryRoot.firstChild(), binaryRoot.firstChild() + 1 };
+        rootNodeIndex = collapseNode(binaryNodes, rootChildren, 2);
+    }
+
+    IF_PROFILING(stats.reorderNodes = true);
+}
+
+// Same collapse as WideBVH<N>, the child bounds are quantized relative to their union.
+// Returns the node index.
+template <uint32_t N, uint32_t Bits>
+uint32_t QuantizedBVH<N, Bits>::collapseNode(const BVH::NodePool& binaryNodes, const uint32_t* binaryChildren, uint32_t binaryChildCount)
+{
+    uint32_t children[N];
+    for (uint32_t i=0; i<binaryChildCount; i++)
+        children[i] = binaryChildren[i];
+    uint32_t childCount = openBinaryChildren(binaryNodes, children, binaryChildCount, N);
+
+    uint32_t nodeIndex = uint32_t(nodePool.size());
+    nodePool.emplace_back();
+
+    // recursion may reallocate the pool, fill a local node and copy it at the end
+    Node node = {};
+    node.childCount = uint8_t(childCount);
+
+    Aabb childBounds[N];
+    for (uint32_t i=0; i<childCount; i++)
+        childBounds[i] = Aabb(binaryNodes[children[i]].aabbMin, binaryNodes[children[i]].aabbMax);
+    quantizeChildren(node, childBounds, childCount);
+
+    for (uint32_t i=0; i<childCount; i++)
+    {
+        const BVHNode& binaryNode = binaryNodes[children[i]];
+        if (binaryNode.isLeaf() && binaryNode.itemCount > Node::kMaxLeafItemCount)
+        {
+            node.child[i] = splitLeaf(childBounds[i], binaryNode.firstItemRef(), binaryNode.itemCount);
+            node.childItemCount[i] = 0;
+        }
+        else if (binaryNode.isLeaf())
+        {
+            node.child[i] = binaryNode.firstItemRef();
+            node.childItemCount[i] = uint16_t(binaryNode.itemCount);
+        }
+        else
+        {
+            uint32_t grandChildren[2] = { binaryNode.firstChild(), binaryNode.firstChild() + 1 };
+            node.child[i] = collapseNode(binaryNodes, grandChildren, 2);
+            node.childItemCount[i] = 0;
+        }
+    }
+
+    nodePool[nodeIndex] = node;
+    return nodeIndex;
+}
+
+// Leaf item counts don't fit more than kMaxLeafItemCount, larger leaves are spread
+// over the children of a node with the leaf bounds. Returns the node index.
+template <uint32_t N, uint32_t Bits>
+uint32_t QuantizedBVH<N, Bits>::splitLeaf(const Math::Aabb& leafBounds, uint32_t firstItemRef, uint32_t itemCount)
+{
+    uint32_t nodeIndex = uint32_t(nodePool.size());
+    nodePool.emplace_back();
+
+    Node node = {};
+    node.childCount = uint8_t(N);
+
+    Aabb childBounds[N];
+    std::fill(childBounds, childBounds + N, leafBounds);
+    quantizeChildren(node, childBounds, N);
+
+    // itemCount > kMaxLeafItemCount leaves every child at least one item
+    uint32_t childItemCount = (itemCount + N - 1) / N;
+    for (uint32_t i=0; i<N; i++)
+    {
+        uint32_t first = firstItemRef + i * childItemCount;
+        uint32_t count = std::min(childItemCount, itemCount - i * childItemCount);
+        if (count > Node::kMaxLeafItemCount)
+        {
+            node.child[i] = splitLeaf(leafBounds, first, count);
+            node.childItemCount[i] = 0;
+        }
+        else
+        {
+            node.child[i] = first;
+            node.childItemCount[i] = uint16_t(count);
+        }
+    }
+
+    nodePool[nodeIndex] = node;
+    return nodeIndex;
+}
+
+template <uint32_t N, uint32_t Bits>
+const char* QuantizedBVH<N, Bits>::getName() const
+{
+    if constexpr (Bits == 8)
+        return N == 2 ? "BVH2Q8" : N == 4 ? "BVH4Q8" : "BVH8Q8";
+    else
+        return N == 2 ? "BVH2Q16" : N == 4 ? "BVH4Q16" : "BVH8Q16";
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Traversal
+///////////////////////////////////////////////////////////////////////////////
+
+// 4 quantized child bounds, binary nodes only hold 2 and repeat them in the upper
+// lanes instead of reading past the arrays
+template <uint32_t N, typename Quantized>
+static simd4f loadQuantized4(const Quantized* q)
+{
+    if constexpr (N == 2)
+        return simd4f(float(q[0]), float(q[1]), float(q[0]), float(q[1]));
+    else
+        return simd4f::load(q);
+}
+
+// Decodes the child bounds and tests them 4 at a time, lanes past childCount are
+// garbage.
+template <uint32_t N, uint32_t Bits>
+static void intersectChildren(const QuantizedBVHNode<N, Bits>& node, const RaySimd4& ray4, float rayT, float* outDist)
+{
+    simd4f origin[3], scale[3];
+    for (uint8_t axis = 0; axis < CoordAxis_Count; axis++)
+    {
+        origin[axis] = simd4f(node.origin[axis]);
+        scale[axis] = simd4f(getScale(node.exponent[axis]));
+    }
+
+    for (uint32_t i=0; i<QuantizedBVHNode<N, Bits>::kLaneCount; i+=4)
+    {
+        simd4f bmin[3], bmax[3];
+        for (uint8_t axis = 0; axis < CoordAxis_Count; axis++)
+        {
+            bmin[axis] = origin[axis] + loadQuantized4<N>(&node.childMin[axis][i]) * scale[axis];
+            bmax[axis] = origin[axis] + loadQuantized4<N>(&node.childMax[axis][i]) * scale[axis];
+        }
+        intersectRayAabb4(ray4, rayT, bmin, bmax).store(&outDist[i]);
+    }
+}
+
+template <uint32_t N, uint32_t Bits>
+void QuantizedBVH<N, Bits>::intersectLeaf(Math::Ray& ray, const Math::RaySimd4& ray4, uint32_t firstItemRef, uint32_t itemCount) const
+{
+#ifdef BVH_USE_TRI_BLOCKS
+    if (triKernel == BVHTriKernel_Watertight)
+        intersectRayTriBlocks(ray, ray4, triVertexBlocks.data(), firstItemRef, itemCount);
+    else
+        intersectRayTriBlocks(ray, ray4, triBlocks.data(), firstItemRef, itemCount);
+#else
+    for (uint32_t i=0; i<itemCount; i++)
+    {
+        uint32_t itemIndex = itemRefs[firstItemRef + i];
+        if (triKernel == BVHTriKernel_Watertight)
+            intersectRayTriWatertight(ray, ray4.shear, items[itemIndex], itemIndex);
+        else
+            intersectRayTri(ray, items[itemIndex], itemIndex);
+    }
+#endif
+}
+
+template <uint32_t N, uint32_t Bits>
+bool QuantizedBVH<N, Bits>::occludedLeaf(const Math::Ray& ray, const Math::RaySimd4& ray4, uint32_t firstItemRef, uint32_t itemCount) const
+{
+#ifdef BVH_USE_TRI_BLOCKS
+    if (triKernel == BVHTriKernel_Watertight)
+        return occludeRayTriBlocks(ray, ray4, triVertexBlocks.data(), firstItemRef, itemCount);
+    else
+        return occludeRayTriBlocks(ray, ray4, triBlocks.data(), firstItemRef, itemCount);
+#else
+    for (uint32_t i=0; i<itemCount; i++)
+    {
+        const Item& item = items[itemRefs[firstItemRef + i]];
+        bool hit = triKernel == BVHTriKernel_Watertight ? occludeRayTriWatertight(ray, ray4.shear, item) : occludeRayTri(ray, item);
+        if (hit)
+            return true;
+    }
+    return false;
+#endif
+}
+
+// same traversal as WideBVH<N>::intersect()
+template <uint32_t N, uint32_t Bits>
+void QuantizedBVH<N, Bits>::intersect(Math::Ray& ray, BVHStats& stats) const
+{
+    struct StackEntry
+    {
+        float dist;
+        uint32_t child;
+        uint32_t itemCount;
+    };
+
+    RaySimd4 ray4(ray, triKernel == BVHTriKernel_Watertight);
+
+    StackEntry stack[BVH::kMaxDepth * N];
+    uint32_t stackPtr = 0;
+
+    const Node* node = &nodePool[rootNodeIndex];
+    while (1)
+    {
+        float dist[Node::kLaneCount];
+        intersectChildren(*node, ray4, ray.hit.t, dist);
+        IF_PROFILING(stats.intersectRayAabbCount += node->childCount);
+
+        // sort hit children by distance, farthest first, and push them so the nearest is popped first
+        StackEntry hits[N];
+        uint32_t hitCount = 0;
+        for (uint32_t i=0; i<node->childCount; i++)
+        {
+            if (dist[i] == Ray::kInf)
+                continue;
+
+            StackEntry entry = { dist[i], node->child[i], node->childItemCount[i] };
+            uint32_t j = hitCount++;
+            for (; j > 0 && hits[j - 1].dist < entry.dist; j--)
+                hits[j] = hits[j - 1];
+            hits[j] = entry;
+        }
+        for (uint32_t i=0; i<hitCount; i++)
+            stack[stackPtr++] = hits[i];
+
+        // pop until we find an internal node, intersecting leaves on the way
+        node = nullptr;
+        while (stackPtr > 0)
+        {
+            const StackEntry& entry = stack[--stackPtr];
+
+            // a closer hit was found since this child was pushed
+            if (entry.dist >= ray.hit.t)
+                continue;
+
+            if (entry.itemCount == 0)
+            {
+                node = &nodePool[entry.child];
+                break;
+            }
+
+            intersectLeaf(ray, ray4, entry.child, entry.itemCount);
+            IF_PROFILING(stats.intersectRayTriCount += entry.itemCount);
+        }
+
+        if (!node)
+            break;
+    }
+}
+
+template <uint32_t N, uint32_t Bits>
+bool QuantizedBVH<N, Bits>::occluded(const Math::Ray& ray, BVHStats& stats) const
+{
+    RaySimd4 ray4(ray, triKernel == BVHTriKernel_Watertight);
+
+    // only internal nodes are pushed
+    uint32_t stack[BVH::kMaxDepth * N];
+    uint32_t stackPtr = 0;
+
+    const Node* node = &nodePool[rootNodeIndex];
+    while (1)
+    {
+        float dist[Node::kLaneCount];
+        intersectChildren(*node, ray4, ray.hit.t, dist);
+        IF_PROFILING(stats.intersectRayAabbCount += node->childCount);
+
+        // leaves are tested right away, a hit there ends the query before any node is pushed
+        for (uint32_t i=0; i<node->childCount; i++)
+        {
+            if (dist[i] == Ray::kInf)
+                continue;
+
+            if (node->isLeaf(i))
+            {
+                IF_PROFILING(stats.intersectRayTriCount += node->childItemCount[i]);
+                if (occludedLeaf(ray, ray4, node->child[i], node->childItemCount[i]))
+                    return true;
+            }
+            else
+            {
+                stack[stackPtr++] = node->child[i];
+            }
+        }
+
+        if (stackPtr == 0)
+            return false;
+
+        node = &nodePool[stack[--stackPtr]];
+    }
+}
+
+template class QuantizedBVH<2, 8>;
+template class QuantizedBVH<4, 8>;
+template class QuantizedBVH<8, 8>;
+template class QuantizedBVH<2, 16>;
+template class QuantizedBVH<4, 16>;
+template class QuantizedBVH<8, 16>;
@@ -0,0 +1,109 @@
+// BVH with child bounds quantized relative to their parent, collapsed from the
+// binary BVH into binary or wide nodes. Bounds are decoded during traversal.
+// https://www.embree.org/papers/2008-EGSR-QBVH.pdf
+
+#pragma once
+
+#include "BVH.h"
+#include <type_traits>
+
+///////////////////////////////////////////////////////////////////////////////
+// Node
+///////////////////////////////////////////////////////////////////////////////
+
+// A child box decodes as origin + q * 2^exponent per axis. The quantized values
+// are rounded outward and checked against the decoded floats, so decoded boxes
+// always contain the exact ones. The power of two scale keeps q * scale exact.
+template <uint32_t N, uint32_t Bits>
+struct QuantizedBVHNode
+{
+    static_assert(N == 2 || N % 4 == 0);
+    static_assert(Bits == 8 || Bits == 16);
+    static constexpr uint32_t kChildCount = N;
+    static constexpr uint32_t kMaxQuantized = (1u << Bits) - 1;
+    static constexpr uint32_t kMaxLeafItemCount = UINT16_MAX;
+    static constexpr uint32_t kLaneCount = (N + 3) & ~3u;    // child bounds are decoded 4 at a time, N == 2 fills 2 lanes
+
+    using Quantized = std::conditional_t<Bits == 8, uint8_t, uint16_t>;
+
+    float origin[3];                // min of the union of the child bounds
+    int8_t exponent[3];
+    uint8_t childCount;
+    Quantized childMin[3][N];
+    Quantized childMax[3][N];
+    uint32_t child[N];              // node index, or first item ref for leaves
+    uint16_t childItemCount[N];     // 0 for internal nodes
+
+    bool isLeaf(uint32_t i) const { return childItemCount[i] > 0; }
+};
+static_assert(sizeof(QuantizedBVHNode<2, 8>) == 40);
+static_assert(sizeof(QuantizedBVHNode<4, 8>) == 64);
+static_assert(sizeof(QuantizedBVHNode<8, 8>) == 112);
+static_assert(sizeof(QuantizedBVHNode<2, 16>) == 52);
+static_assert(sizeof(QuantizedBVHNode<4, 16>) == 88);
+static_assert(sizeof(QuantizedBVHNode<8, 16>) == 160);
+
+
+///////////////////////////////////////////////////////////////////////////////
+// QuantizedBVH
+///////////////////////////////////////////////////////////////////////////////
+
+// Children are opened up like WideBVH<N>'s, with N == 2 the binary tree is kept.
+// Against 32 byte binary nodes and 128/256 byte wide nodes, 8-bit nodes take
+// 62%, 50% and 44% of the memory, 16-bit nodes 81%, 69% and 62%.
+template <uint32_t N, uint32_t Bits>
+class QuantizedBVH final : public AccelStruct
+{
+public:
+    using Item = BVH::Item;
+    using Node = QuantizedBVHNode<N, Bits>;
+    using NodePool = std::vector<Node>;
+
+private:
+    // items, shared with the binary BVH, item refs and triangle blocks are copied
+    const Item* items;
+    BVH::ItemRefs itemRefs;
+    BVH::TriBlocks triBlocks;
+    BVH::TriVertexBlocks triVertexBlocks;
+    BVHTriKernel triKernel;
+
+    // nodes
+    NodePool nodePool;
+    uint32_t rootNodeIndex;
+    Math::Aabb bounds;              // of the binary root, nodes only keep child bounds
+
+    uint32_t collapseNode(const BVH::NodePool& binaryNodes, const uint32_t* binaryChildren, uint32_t binaryChildCount);
+    uint32_t splitLeaf(const Math::Aabb& leafBounds, uint32_t firstItemRef, uint32_t itemCount);
+
+    void intersectLeaf(Math::Ray& ray, const Math::RaySimd4& ray4, uint32_t firstItemRef, uint32_t itemCount) const;
+    bool occludedLeaf(const Math::Ray& ray, const Math::RaySimd4& ray4, uint32_t firstItemRef, uint32_t itemCount) const;
+
+public:
+    explicit QuantizedBVH(const BVH& bvh);
+
+    // AccelStruct
+    const char* getName() const override;
+    uint32_t getNodeCount() const override { return uint32_t(nodePool.size()); }
+    size_t getNodeMemorySize() const override { return nodePool.size() * sizeof(Node); }
+    Math::Aabb getBounds() const override { return bounds; }
+
+    using AccelStruct::intersect;
+    void intersect(Math::Ray& ray, BVHStats& stats) const override;
+
+    using AccelStruct::occluded;
+    bool occluded(const Math::Ray& ray, BVHStats& stats) const override;
+};
+
+extern template class QuantizedBVH<2, 8>;
+extern template class QuantizedBVH<4, 8>;
+extern template class QuantizedBVH<8, 8>;
+extern template class QuantizedBVH<2, 16>;
+extern template class QuantizedBVH<4, 16>;
+extern template class QuantizedBVH<8, 16>;
+
+using BVH2Q8 = QuantizedBVH<2, 8>;
+using BVH4Q8 = QuantizedBVH<4, 8>;
+using BVH8Q8 = QuantizedBVH<8, 8>;
+using BVH2Q16 = QuantizedBVH<2, 16>;
+using BVH4Q16 = QuantizedBVH<4, 16>;
+using BVH8Q16 = QuantizedBVH<8, 16>;
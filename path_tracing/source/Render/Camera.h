@@ -0,0 +1,29 @@
+#pragma once
+
+#include "../Math/Ray.h"
+
+struct Camera
+{
+    Math::float3 pos;
+    Math::float3 p0;  // top-left
+    Math::float3 p1;  // top-right
+    Math::float3 p2;  // bottom-left
+
+    // u, v in [0, 1] from the top-left corner of the screen
+    Math::Ray getRay(float u, float v) const
+    {
+        Math::float3 pixelPos = p0 + (p1 - p0) * u + (p2 - p0) * v;
+        return Math::Ray( pos, normalize( pixelPos - pos ) );
+    }
+
+    // screen at distance 1 from pos, halfSize wide in each direction
+    static Camera lookAt(const Math::float3& pos, const Math::float3& target, float halfSize)
+    {
+        Math::float3 forward = normalize(target - pos);
+        Math::float3 right = normalize(cross(Math::float3( 0.0f, 1.0f, 0.0f ), forward));
+        Math::float3 up = cross(forward, right);
+
+        Math::float3 center = pos + forward;
+        return Camera{ pos, center + (up - right) * halfSize, center + (up + right) * halfSize, center - (up + right) * halfSize };
+    }
+};
@@ -0,0 +1,156 @@
+#include "PathTracer.h"
+#include "../Util.h"
+#include <cmath>
+using namespace Math;
+
+// offset of secondary ray origins along the normal, so they don't hit their own triangle
+static constexpr float kRayBias = 1e-4f;
+
+// Orthonormal basis around n, Duff et al. 2017, Building an Orthonormal Basis, Revisited
+static void buildBasis(const float3& n, float3& outTangent, float3& outBitangent)
+{
+    float sign = std::copysign(1.0f, n.z);
+    float a = -1.0f / (sign + n.z);
+    float b = n.x * n.y * a;
+    outTangent = float3( 1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x );
+    outBitangent = float3( b, sign + n.y * n.y * a, -n.y );
+}
+
+// pdf = cos(theta) / pi
+static float3 sampleCosineHemisphere(const float3& n, uint32_t& seed)
+{
+    float r1 = RandomFloat(seed);
+    float r2 = RandomFloat(seed);
+    float r = std::sqrt(r1);
+    float phi = 2.0f * pif * r2;
+
+    float3 tangent, bitangent;
+    buildBasis(n, tangent, bitangent);
+    return tangent * (r * std::cos(phi)) + bitangent * (r * std::sin(phi)) + n * std::sqrt(std::max(0.0f, 1.0f - r1));
+}
+
+// pdf = 1 / (4 pi)
+static float3 sampleUniformSphere(uint32_t& seed)
+{
+    float z = 1.0f - 2.0f * RandomFloat(seed);
+    float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+    float phi = 2.0f * pif * RandomFloat(seed);
+    return float3( r * std::cos(phi), r * std::sin(phi), z );
+}
+
+PathTracer::PathTracer(const AccelStruct& accel, const Math::Tri* tris, const PathTracerParams& params)
+    : accel(accel)
+    , tris(tris)
+    , params(params)
+{
+}
+
+// Light sample at a diffuse surface point, without the throughput and the albedo / pi of the surface
+bool PathTracer::sampleLight(const float3& pos, const float3& normal, uint32_t& seed, LightSample& outSample) const
+{
+    const SphereLight& light = params.light;
+
+    // uniform point on the light's surface, pdf = 1 / area
+    float3 lightNormal = sampleUniformSphere(seed);
+    float3 lightPos = light.position + lightNormal * light.radius;
+
+    float3 toLight = lightPos - pos;
+    float distSqr = dot(toLight, toLight);
+    float dist = std::sqrt(distSqr);
+    float3 dir = toLight / dist;
+
+    float cosSurface = dot(normal, dir);
+    float cosLight = -dot(lightNormal, dir);
+    if (cosSurface <= 0.0f || cosLight <= 0.0f)
+        return false;
+
+    float area = 4.0f * pif * light.radius * light.radius;
+    outSample.shadowRay = Ray(pos + normal * kRayBias, dir, dist * (1.0f - 1e-4f));
+    outSample.radiance = light.radiance * (cosSurface * cosLight * area / distSqr);
+    return true;
+}
+
+PathState PathTracer::startPath(const Ray& ray, uint32_t seed) const
+{
+    PathState state;
+    state.ray = ray;
+    state.throughput = float3(1.0f);
+    state.radiance = float3(0.0f);
+    state.seed = seed;
+    state.depth = 0;
+    return state;
+}
+
+bool PathTracer::shade(PathState& state, LightSample& outLightSample) const
+{
+    outLightSample.valid = false;
+
+    const Ray& ray = state.ray;
+    if (!ray.hit.isValid())
+    {
+        state.radiance += state.throughput * params.skyRadiance;
+        return false;
+    }
+
+    // triangles are two sided
+    const Tri& tri = tris[ray.hit.primId];
+    float3 normal = computeNormal(tri);
+    if (dot(normal, ray.D) > 0.0f)
+        normal = -normal;
+    float3 pos = interpolatePosition(tri, ray.hit.u, ray.hit.v);
+
+    // next event estimation, the light isn't geometry so bounces never hit it
+    const float3 brdf = params.albedo * one_over_pif;
+    if (sampleLight(pos, normal, state.seed, outLightSample))
+    {
+        outLightSample.radiance = state.throughput * brdf * outLightSample.radiance;
+        outLightSample.valid = true;
+    }
+
+    if (state.depth + 1 == params.maxDepth)
+        return false;
+
+    // brdf * cos / pdf of cosine weighted sampling leaves the albedo
+    state.throughput *= params.albedo;
+
+    if (state.depth + 1 >= params.rouletteDepth)
+    {
+        float survival = clamp(std::max(state.throughput.x, std::max(state.throughput.y, state.throughput.z)), 0.05f, 0.95f);
+        if (RandomFloat(state.seed) >= survival)
+            return false;
+        state.throughput /= survival;
+    }
+
+    state.ray = Ray(pos + normal * kRayBias, sampleCosineHemisphere(normal, state.seed));
+    state.depth++;
+    return true;
+}
+
+float3 PathTracer::trace(Ray ray, uint32_t& seed, PathTracerStats& stats) const
+{
+    PathState state = startPath(ray, seed);
+
+    bool alive = true;
+    while (alive)
+    {
+        if (state.depth == 0)
+            stats.primaryRayCount++;
+        else
+            stats.bounceRayCount++;
+
+        accel.intersect(state.ray, stats.bvh);
+
+        LightSample lightSample;
+        alive = shade(state, lightSample);
+
+        if (lightSample.valid)
+        {
+            stats.shadowRayCount++;
+            if (!accel.occluded(lightSample.shadowRay, stats.bvh))
+                state.radiance += lightSample.radiance;
+        }
+    }
+
+    seed = state.seed;
+    return state.radiance;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "../BVH.h"
+#include "../Math/Tri.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Scene lighting
+///////////////////////////////////////////////////////////////////////////////
+
+// Spherical area light, not part of the traced geometry so it is only reached
+// through light sampling
+struct SphereLight
+{
+    Math::float3 position;
+    float radius;
+    Math::float3 radiance;
+};
+
+struct PathTracerParams
+{
+    uint32_t samplesPerPixel = 4;
+    uint32_t maxDepth = 8;              // path vertices, 1 is direct lighting only
+    uint32_t rouletteDepth = 3;         // paths longer than this are terminated randomly
+
+    Math::float3 albedo = Math::float3(0.7f);   // of all triangles, lambertian
+    Math::float3 skyRadiance = Math::float3(0.2f, 0.25f, 0.35f);
+    SphereLight light = { Math::float3(-1.0f, 1.0f, -1.5f), 0.1f, Math::float3(200.0f) };
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Stats
+///////////////////////////////////////////////////////////////////////////////
+
+struct PathTracerStats
+{
+    BVHStats bvh;
+    uint64_t primaryRayCount = 0;
+    uint64_t bounceRayCount = 0;
+    uint64_t shadowRayCount = 0;
+
+    uint64_t getRayCount() const { return primaryRayCount + bounceRayCount + shadowRayCount; }
+
+    PathTracerStats& operator+=(const PathTracerStats& other)
+    {
+        bvh += other.bvh;
+        primaryRayCount += other.primaryRayCount;
+        bounceRayCount += other.bounceRayCount;
+        shadowRayCount += other.shadowRayCount;
+        return *this;
+    }
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Path state
+///////////////////////////////////////////////////////////////////////////////
+
+// What a path carries between bounces. trace() keeps one on the stack, the
+// wavefront renderer keeps one per path in memory.
+struct PathState
+{
+    Math::Ray ray;                  // to intersect next
+    Math::float3 throughput;
+    Math::float3 radiance;          // gathered so far
+    uint32_t seed;
+    uint32_t depth;                 // of the vertex ray will hit, 0 for camera rays
+};
+
+// Next event estimation from one path vertex, the radiance is only added when
+// the shadow ray isn't occluded
+struct LightSample
+{
+    Math::Ray shadowRay;
+    Math::float3 radiance;          // path throughput and brdf applied
+    bool valid = false;             // false when the light is behind the surface or facing away
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// PathTracer
+///////////////////////////////////////////////////////////////////////////////
+
+// Unidirectional path tracer over diffuse triangles: cosine weighted bounces,
+// next event estimation with an occluded() query per path vertex and Russian
+// roulette. Const, threads trace with their own RNG seed and stats.
+class PathTracer
+{
+    const AccelStruct& accel;
+    const Math::Tri* tris;      // the items accel was built over, indexed by Hit::primId
+    PathTracerParams params;
+
+    bool sampleLight(const Math::float3& pos, const Math::float3& normal, uint32_t& seed, LightSample& outSample) const;
+
+public:
+    PathTracer(const AccelStruct& accel, const Math::Tri* tris, const PathTracerParams& params = PathTracerParams());
+
+    const AccelStruct& getAccel() const { return accel; }
+    const PathTracerParams& getParams() const { return params; }
+
+    PathState startPath(const Math::Ray& ray, uint32_t seed) const;
+
+    // Continues the path after state.ray was intersected: adds the sky on a miss,
+    // samples the light at a hit and replaces state.ray by the bounce ray.
+    // Returns false when the path ends, the light sample is still to be traced then.
+    bool shade(PathState& state, LightSample& outLightSample) const;
+
+    // radiance arriving along the ray, one sample
+    Math::float3 trace(Math::Ray ray, uint32_t& seed, PathTracerStats& stats) const;
+};
@@ -0,0 +1,374 @@
+#include "Renderer.h"
+#include "../Image/AccumulationBuffer.h"
+#include "../Image/Image.h"
+#include "../Math/Aabb.h"
+#include "../Math/Morton.h"
+#include "../Util.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+using namespace Math;
+
+Renderer::Renderer(TaskSystem& taskSystem, uint32_t tileSize)
+    : taskSystem(taskSystem)
+    , tileSize(tileSize)
+{
+}
+
+BVHStats Renderer::renderDepth(const AccelStruct& accel, const Camera& cam, Image& img)
+{
+    // one stats block per thread, on separate cache lines
+    struct alignas(64) ThreadStats
+    {
+        BVHStats stats;
+    };
+    std::vector<ThreadStats> threadStats(taskSystem.getThreadCount());
+
+    forEachTile(img.width, img.height, [&](const RenderTile& tile, uint32_t threadIndex)
+    {
+        BVHStats& stats = threadStats[threadIndex].stats;
+
+        // shade into a local buffer and copy whole rows out, so threads only
+        // touch the cache lines shared with neighbour tiles once per row
+        std::vector<Image::Pixel> tilePixels(tile.width * tile.height);
+
+        for (uint32_t y = 0; y < tile.height; y++)
+        {
+            for (uint32_t x = 0; x < tile.width; x++)
+            {
+                uint32_t px = tile.x + x;
+                uint32_t py = tile.y + y;
+                Ray ray = cam.getRay(px / float(img.width), py / float(img.height));
+                accel.intersect(ray, stats);
+
+                Image::Pixel& pixel = tilePixels[y * tile.width + x];
+                pixel = colors::black();
+                if (ray.hit.t < Ray::kInf)
+                {
+                    // depth as color
+                    uint8_t d = uint8_t(saturate(1.0f - ray.hit.t / 4.0f) * 255.0f);
+                    pixel = color3b(d);
+                }
+            }
+        }
+
+        for (uint32_t y = 0; y < tile.height; y++)
+        {
+            const Image::Pixel* row = &tilePixels[y * tile.width];
+            std::copy(row, row + tile.width, &img(tile.x, tile.y + y));
+        }
+    });
+
+    BVHStats stats;
+#ifdef BVH_ENABLE_PROFILING
+    stats.reorderNodes = accel.getStats().reorderNodes;
+#endif
+    for (const ThreadStats& s : threadStats)
+        stats += s.stats;
+    return stats;
+}
+
+// Adds samplesPerPixel jittered paths to every pixel of the tile
+static void renderPathTracedTile(const PathTracer& pathTracer, const Camera& cam, AccumulationBuffer& accum, const RenderTile& tile, uint32_t samplesPerPixel, PathTracerStats& stats)
+{
+    // each pixel is written once per pass, tiles own their pixels
+    for (uint32_t py = tile.y; py < tile.y + tile.height; py++)
+    {
+        for (uint32_t px = tile.x; px < tile.x + tile.width; px++)
+        {
+            // seeded by pixel and sample count, the image doesn't depend on the tile order
+            uint32_t seed = InitSeed(WangHash(py * accum.width + px) + uint32_t(accum(px, py).a));
+
+            float3 radiance(0.0f);
+            float luminanceSqrSum = 0.0f;
+            for (uint32_t sample = 0; sample < samplesPerPixel; sample++)
+            {
+                float u = (px + RandomFloat(seed)) / float(accum.width);
+                float v = (py + RandomFloat(seed)) / float(accum.height);
+                float3 sampleRadiance = pathTracer.trace(cam.getRay(u, v), seed, stats);
+
+                float luminance = AccumulationBuffer::getLuminance(sampleRadiance);
+                radiance += sampleRadiance;
+                luminanceSqrSum += luminance * luminance;
+            }
+
+            accum.addSamples(px, py, radiance, luminanceSqrSum, samplesPerPixel);
+        }
+    }
+}
+
+// mean display error of the tile's pixels, a few noisy pixels don't keep a tile alive on their own
+static float estimateTileError(const AccumulationBuffer& accum, const RenderTile& tile)
+{
+    float errorSum = 0.0f;
+    for (uint32_t py = tile.y; py < tile.y + tile.height; py++)
+    {
+        for (uint32_t px = tile.x; px < tile.x + tile.width; px++)
+            errorSum += accum.estimateError(px, py);
+    }
+    return errorSum / float(tile.width * tile.height);
+}
+
+PathTracerStats Renderer::renderPathTraced(const PathTracer& pathTracer, const Camera& cam, AccumulationBuffer& accum, uint32_t samplesPerPixel)
+{
+    struct alignas(64) ThreadStats
+    {
+        PathTracerStats stats;
+        Aabb originBounds;      // of the paths this thread keyed in the current bounce
+    };
+    std::vector<ThreadStats> threadStats(taskSystem.getThreadCount());
+
+    forEachTile(accum.width, accum.height, [&](const RenderTile& tile, uint32_t threadIndex)
+    {
+        renderPathTracedTile(pathTracer, cam, accum, tile, samplesPerPixel, threadStats[threadIndex].stats);
+    });
+
+    PathTracerStats stats;
+#ifdef BVH_ENABLE_PROFILING
+    stats.bvh.reorderNodes = pathTracer.getAccel().getStats().reorderNodes;
+#endif
+    for (const ThreadStats& s : threadStats)
+        stats += s.stats;
+    return stats;
+}
+
+AdaptiveSamplingResult Renderer::renderPathTracedAdaptive(const PathTracer& pathTracer, const Camera& cam, AccumulationBuffer& accum, const AdaptiveSamplingParams& params)
+{
+    struct alignas(64) ThreadStats
+    {
+        PathTracerStats stats;
+        Aabb originBounds;      // of the paths this thread keyed in the current bounce
+    };
+    std::vector<ThreadStats> threadStats(taskSystem.getThreadCount());
+
+    AdaptiveSamplingResult result;
+    result.tileCount = getTileCount(accum.width, accum.height);
+
+    std::vector<uint32_t> activeTiles(result.tileCount);
+    for (uint32_t i = 0; i < result.tileCount; i++)
+        activeTiles[i] = i;
+    std::vector<float> tileErrors(result.tileCount);
+
+    // all active tiles have the same number of samples
+    uint32_t sampleCount = 0;
+    while (!activeTiles.empty() && sampleCount < params.maxSamplesPerPixel)
+    {
+        uint32_t passSamples = sampleCount < params.minSamplesPerPixel ? params.minSamplesPerPixel - sampleCount : params.samplesPerPass;
+        passSamples = std::min(passSamples, params.maxSamplesPerPixel - sampleCount);
+
+        // the error is estimated right after sampling, while the tile is in cache
+        forEachTile(accum.width, accum.height, activeTiles, [&](const RenderTile& tile, uint32_t threadIndex)
+        {
+            renderPathTracedTile(pathTracer, cam, accum, tile, passSamples, threadStats[threadIndex].stats);
+            tileErrors[tile.index] = estimateTileError(accum, tile);
+        });
+
+        sampleCount += passSamples;
+        result.passCount++;
+
+        std::erase_if(activeTiles, [&](uint32_t tileIndex) { return tileErrors[tileIndex] <= params.errorThreshold; });
+    }
+    result.convergedTileCount = result.tileCount - uint32_t(activeTiles.size());
+
+#ifdef BVH_ENABLE_PROFILING
+    result.stats.bvh.reorderNodes = pathTracer.getAccel().getStats().reorderNodes;
+#endif
+    for (const ThreadStats& s : threadStats)
+        result.stats += s.stats;
+    return result;
+}
+
+PathTracerStats Renderer::renderPathTracedWavefront(const PathTracer& pathTracer, const Camera& cam, AccumulationBuffer& accum, uint32_t samplesPerPixel, const WavefrontParams& params)
+{
+    // paths per task of a stage
+    const uint32_t kGrainSize = 1024;
+
+    struct alignas(64) ThreadStats
+    {
+        PathTracerStats stats;
+        Aabb originBounds;      // of the paths this thread keyed in the current bounce
+    };
+    std::vector<ThreadStats> threadStats(taskSystem.getThreadCount());
+
+    struct WavefrontPath
+    {
+        PathState state;
+        uint32_t slot;      // pixel index in the wave
+    };
+
+    const AccelStruct& accel = pathTracer.getAccel();
+    const uint32_t pixelCount = accum.width * accum.height;
+    const uint32_t waveSize = std::min(params.waveSize, pixelCount);
+
+    std::vector<WavefrontPath> paths(waveSize);
+    std::vector<WavefrontPath> sortedPaths(waveSize);
+    std::vector<LightSample> lightSamples(waveSize);
+    std::vector<uint8_t> alive(waveSize);
+    std::vector<float3> waveRadiance(waveSize);
+    std::vector<uint64_t> sortKeys;
+    std::vector<uint32_t> sortValues;
+
+    for (uint32_t sample = 0; sample < samplesPerPixel; sample++)
+    {
+        for (uint32_t waveBegin = 0; waveBegin < pixelCount; waveBegin += waveSize)
+        {
+            uint32_t pathCount = std::min(waveSize, pixelCount - waveBegin);
+
+            // camera rays in pixel order are coherent already
+            taskSystem.parallelFor(0, pathCount, kGrainSize, [&](uint32_t begin, uint32_t end)
+            {
+                PROFILE_ZONE("wavefront camera rays");
+                for (uint32_t i = begin; i < end; i++)
+                {
+                    uint32_t pixelIndex = waveBegin + i;
+                    uint32_t px = pixelIndex % accum.width;
+                    uint32_t py = pixelIndex / accum.width;
+
+                    // same seed as a 1 spp pass of renderPathTraced()
+                    uint32_t seed = InitSeed(WangHash(pixelIndex) + uint32_t(accum.pixels[pixelIndex].a));
+                    float u = (px + RandomFloat(seed)) / float(accum.width);
+                    float v = (py + RandomFloat(seed)) / float(accum.height);
+
+                    paths[i].state = pathTracer.startPath(cam.getRay(u, v), seed);
+                    paths[i].slot = i;
+                }
+            });
+            threadStats[0].stats.primaryRayCount += pathCount;
+
+            while (pathCount > 0)
+            {
+                // extend: closest hits of the whole stream
+                taskSystem.parallelFor(0, pathCount, kGrainSize, [&](uint32_t begin, uint32_t end)
+                {
+                    PROFILE_ZONE("wavefront extend");
+                    PathTracerStats& stats = threadStats[taskSystem.getThreadIndex()].stats;
+                    for (uint32_t i = begin; i < end; i++)
+                        accel.intersect(paths[i].state.ray, stats.bvh);
+                });
+
+                // shade: light samples and bounce rays
+                taskSystem.parallelFor(0, pathCount, kGrainSize, [&](uint32_t begin, uint32_t end)
+                {
+                    PROFILE_ZONE("wavefront shade");
+                    for (uint32_t i = begin; i < end; i++)
+                        alive[i] = pathTracer.shade(paths[i].state, lightSamples[i]);
+                });
+
+                // connect: shadow rays of the stream, then finished paths hand in their sample
+                taskSystem.parallelFor(0, pathCount, kGrainSize, [&](uint32_t begin, uint32_t end)
+                {
+                    PROFILE_ZONE("wavefront connect");
+                    PathTracerStats& stats = threadStats[taskSystem.getThreadIndex()].stats;
+                    for (uint32_t i = begin; i < end; i++)
+                    {
+                        PathState& state = paths[i].state;
+                        const LightSample& lightSample = lightSamples[i];
+                        if (lightSample.valid)
+                        {
+                            stats.shadowRayCount++;
+                            if (!accel.occluded(lightSample.shadowRay, stats.bvh))
+                                state.radiance += lightSample.radiance;
+                        }
+
+                        if (!alive[i])
+                            waveRadiance[paths[i].slot] = state.radiance;
+                    }
+                });
+
+                // compact the survivors, sorted or in their current order
+                PROFILE_ZONE("wavefront compact");
+                sortValues.clear();
+                for (uint32_t i = 0; i < pathCount; i++)
+                {
+                    if (alive[i])
+                        sortValues.push_back(i);
+                }
+                pathCount = uint32_t(sortValues.size());
+
+                // the alive scan and RadixSort stay serial, keys, bounds and the gather are
+                // split over the tasks
+                if (params.sortRays && pathCount > 1)
+                {
+                    for (ThreadStats& s : threadStats)
+                        s.originBounds = Aabb();
+                    taskSystem.parallelFor(0, pathCount, kGrainSize, [&](uint32_t begin, uint32_t end)
+                    {
+                        PROFILE_ZONE("wavefront origin bounds");
+                        Aabb& bounds = threadStats[taskSystem.getThreadIndex()].originBounds;
+                        for (uint32_t k = begin; k < end; k++)
+                            bounds.expand(paths[sortValues[k]].state.ray.O);
+                    });
+
+                    Aabb originBounds;
+                    for (const ThreadStats& s : threadStats)
+                        originBounds.expand(s.originBounds);
+
+                    float3 extent = originBounds.extent();
+                    float3 scale;
+                    for (uint8_t axis = 0; axis < CoordAxis_Count; axis++)
+                        scale[axis] = extent[axis] > 0.0f ? 1.0f / extent[axis] : 0.0f;
+
+                    // octant in the top bits, rays of one octant visit children in the same order
+                    sortKeys.resize(pathCount);
+                    taskSystem.parallelFor(0, pathCount, kGrainSize, [&](uint32_t begin, uint32_t end)
+                    {
+                        PROFILE_ZONE("wavefront sort keys");
+                        for (uint32_t k = begin; k < end; k++)
+                        {
+                            const Ray& ray = paths[sortValues[k]].state.ray;
+                            uint64_t octant = (ray.D.x < 0.0f ? 1 : 0) | (ray.D.y < 0.0f ? 2 : 0) | (ray.D.z < 0.0f ? 4 : 0);
+                            sortKeys[k] = (octant << 30) | morton30((ray.O - originBounds.min) * scale);
+                        }
+                    });
+
+                    PROFILE_ZONE("wavefront sort");
+                    RadixSort(sortKeys, sortValues, 33);
+                }
+
+                taskSystem.parallelFor(0, pathCount, kGrainSize, [&](uint32_t begin, uint32_t end)
+                {
+                    PROFILE_ZONE("wavefront gather");
+                    for (uint32_t k = begin; k < end; k++)
+                        sortedPaths[k] = paths[sortValues[k]];
+                });
+                paths.swap(sortedPaths);
+
+                threadStats[0].stats.bounceRayCount += pathCount;
+            }
+
+            // each pixel has one path in the wave, so pixels are written once
+            uint32_t waveEnd = std::min(pixelCount, waveBegin + waveSize);
+            taskSystem.parallelFor(waveBegin, waveEnd, kGrainSize, [&](uint32_t begin, uint32_t end)
+            {
+                PROFILE_ZONE("wavefront accumulate");
+                for (uint32_t pixelIndex = begin; pixelIndex < end; pixelIndex++)
+                    accum.addSample(pixelIndex % accum.width, pixelIndex / accum.width, waveRadiance[pixelIndex - waveBegin]);
+            });
+        }
+    }
+
+    PathTracerStats stats;
+#ifdef BVH_ENABLE_PROFILING
+    stats.bvh.reorderNodes = accel.getStats().reorderNodes;
+#endif
+    for (const ThreadStats& s : threadStats)
+        stats += s.stats;
+    return stats;
+}
+
+PathTracerStats Renderer::renderPathTraced(const PathTracer& pathTracer, const Camera& cam, Image& img)
+{
+    AccumulationBuffer accum(img.width, img.height);
+    PathTracerStats stats = renderPathTraced(pathTracer, cam, accum, pathTracer.getParams().samplesPerPixel);
+    resolve(accum, img);
+    return stats;
+}
+
+void Renderer::resolve(const AccumulationBuffer& accum, Image& img, float exposure)
+{
+    taskSystem.parallelFor(0, accum.height, 16, [&](uint32_t beginRow, uint32_t endRow)
+    {
+        PROFILE_ZONE("resolve");
+        accum.resolve(img, beginRow, endRow, exposure);
+    });
+}
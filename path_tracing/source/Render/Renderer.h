@@ -0,0 +1,181 @@
+#pragma once
+
+#include "../BVH.h"
+#include "../Core/Profiler.h"
+#include "../Core/TaskSystem.h"
+#include "Camera.h"
+#include "PathTracer.h"
+#include <vector>
+
+struct AccumulationBuffer;
+struct Image;
+
+///////////////////////////////////////////////////////////////////////////////
+// Tile
+///////////////////////////////////////////////////////////////////////////////
+
+struct RenderTile
+{
+    uint32_t index;     // row major in the image's tile grid
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Adaptive sampling
+///////////////////////////////////////////////////////////////////////////////
+
+struct AdaptiveSamplingParams
+{
+    uint32_t minSamplesPerPixel = 8;    // taken by every pixel before the first error estimate
+    uint32_t maxSamplesPerPixel = 256;
+    uint32_t samplesPerPass = 4;
+    float errorThreshold = 0.01f;       // AccumulationBuffer::estimateError() averaged over a tile
+};
+
+struct AdaptiveSamplingResult
+{
+    PathTracerStats stats;
+    uint32_t passCount = 0;
+    uint32_t tileCount = 0;
+    uint32_t convergedTileCount = 0;    // tiles that dropped out below the threshold before maxSamplesPerPixel
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Wavefront
+///////////////////////////////////////////////////////////////////////////////
+
+struct WavefrontParams
+{
+    uint32_t waveSize = 64 * 1024;      // paths in flight, one per pixel of a wave
+    bool sortRays = true;               // bounce rays by direction octant, then origin Morton code
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Renderer
+///////////////////////////////////////////////////////////////////////////////
+
+// Splits images into square tiles and renders them on all threads of a TaskSystem.
+class Renderer
+{
+    TaskSystem& taskSystem;
+    uint32_t tileSize;
+
+    template <typename Func>
+    void splitTiles(uint32_t begin, uint32_t end, const Func& func);
+
+public:
+    Renderer(TaskSystem& taskSystem, uint32_t tileSize = 32);
+
+    TaskSystem& getTaskSystem() { return taskSystem; }
+    uint32_t getTileSize() const { return tileSize; }
+
+    // Calls renderTile(tile, threadIndex) once for every tile of a width x height image.
+    // The tile range is halved recursively into tasks, so idle threads steal large ranges.
+    template <typename TileFunc>
+    void forEachTile(uint32_t width, uint32_t height, const TileFunc& renderTile);
+
+    // Same for the tiles listed in tileIndices only
+    template <typename TileFunc>
+    void forEachTile(uint32_t width, uint32_t height, const std::vector<uint32_t>& tileIndices, const TileFunc& renderTile);
+
+    uint32_t getTileCount(uint32_t width, uint32_t height) const;
+    RenderTile getTile(uint32_t width, uint32_t height, uint32_t tileIndex) const;
+
+    // Depth as color of the primary hits, returns the stats merged over all threads
+    BVHStats renderDepth(const AccelStruct& accel, const Camera& cam, Image& img);
+
+    // Progressive pass: adds samplesPerPixel jittered paths per pixel to accum.
+    // Seeds depend on the pixel and its sample count, so passes are deterministic.
+    PathTracerStats renderPathTraced(const PathTracer& pathTracer, const Camera& cam, AccumulationBuffer& accum, uint32_t samplesPerPixel);
+
+    // pathTracer.getParams().samplesPerPixel paths per pixel in one pass, resolved into img
+    PathTracerStats renderPathTraced(const PathTracer& pathTracer, const Camera& cam, Image& img);
+
+    // Passes of params.samplesPerPass paths over the tiles whose estimated error is
+    // still above params.errorThreshold, converged tiles drop out of the tile
+    // scheduler. Every pixel of a tile gets the same number of samples.
+    AdaptiveSamplingResult renderPathTracedAdaptive(const PathTracer& pathTracer, const Camera& cam, AccumulationBuffer& accum, const AdaptiveSamplingParams& params);
+
+    // Same estimator as renderPathTraced() with passes of 1 spp, but paths advance
+    // as a stream: every stage (extend, shade, shadow rays) runs over all paths
+    // of a wave before the next, survivors are compacted and sorted in between
+    // so consecutive rays traverse similar parts of the BVH.
+    PathTracerStats renderPathTracedWavefront(const PathTracer& pathTracer, const Camera& cam, AccumulationBuffer& accum, uint32_t samplesPerPixel, const WavefrontParams& params = WavefrontParams());
+
+    // AccumulationBuffer::resolve() spread over the threads by rows
+    void resolve(const AccumulationBuffer& accum, Image& img, float exposure = 1.0f);
+};
+
+template <typename Func>
+void Renderer::splitTiles(uint32_t begin, uint32_t end, const Func& func)
+{
+    if (end - begin == 1)
+    {
+        func(begin);
+        return;
+    }
+
+    uint32_t mid = (begin + end) / 2;
+
+    TaskGroup group;
+    taskSystem.submit(group, [this, mid, end, &func]() { splitTiles(mid, end, func); });
+    splitTiles(begin, mid, func);
+    taskSystem.wait(group);
+}
+
+inline uint32_t Renderer::getTileCount(uint32_t width, uint32_t height) const
+{
+    const uint32_t tileCountX = (width + tileSize - 1) / tileSize;
+    const uint32_t tileCountY = (height + tileSize - 1) / tileSize;
+    return tileCountX * tileCountY;
+}
+
+inline RenderTile Renderer::getTile(uint32_t width, uint32_t height, uint32_t tileIndex) const
+{
+    const uint32_t tileCountX = (width + tileSize - 1) / tileSize;
+
+    RenderTile tile;
+    tile.index = tileIndex;
+    tile.x = (tileIndex % tileCountX) * tileSize;
+    tile.y = (tileIndex / tileCountX) * tileSize;
+    tile.width = std::min(tileSize, width - tile.x);
+    tile.height = std::min(tileSize, height - tile.y);
+    return tile;
+}
+
+template <typename TileFunc>
+void Renderer::forEachTile(uint32_t width, uint32_t height, const TileFunc& renderTile)
+{
+    const uint32_t tileCount = getTileCount(width, height);
+    if (tileCount == 0)
+        return;
+
+    auto renderTileIndex = [&](uint32_t tileIndex)
+    {
+        PROFILE_ZONE("tile");
+        renderTile(getTile(width, height, tileIndex), taskSystem.getThreadIndex());
+    };
+
+    splitTiles(0, tileCount, renderTileIndex);
+}
+
+template <typename TileFunc>
+void Renderer::forEachTile(uint32_t width, uint32_t height, const std::vector<uint32_t>& tileIndices, const TileFunc& renderTile)
+{
+    if (tileIndices.empty())
+        return;
+
+    auto renderTileIndex = [&](uint32_t i)
+    {
+        PROFILE_ZONE("tile");
+        renderTile(getTile(width, height, tileIndices[i]), taskSystem.getThreadIndex());
+    };
+
+    splitTiles(0, uint32_t(tileIndices.size()), renderTileIndex);
+}
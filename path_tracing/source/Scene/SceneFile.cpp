@@ -0,0 +1,120 @@
+#include "SceneFile.h"
+
+#include <charconv>
+#include <cstdio>
+#include <vector>
+
+using namespace Math;
+
+bool SceneFile::load(const char* filepath)
+{
+    tris = nullptr;
+    triCount = 0;
+    bounds = Aabb();
+
+    if (!file.open(filepath))
+        return false;
+
+    const SceneFileHeader* header = reinterpret_cast<const SceneFileHeader*>(file.getData());
+    bool valid = file.getSize() >= sizeof(SceneFileHeader)
+        && header->magic == SceneFileHeader::kMagic
+        && header->version == SceneFileHeader::kVersion
+        && header->headerSize == sizeof(SceneFileHeader)
+        && header->triSize == sizeof(Tri)
+        && header->triCount <= UINT32_MAX
+        && header->triOffset % alignof(Tri) == 0
+        && header->triOffset <= file.getSize()
+        && header->triCount <= (file.getSize() - header->triOffset) / sizeof(Tri);
+
+    if (!valid)
+    {
+        file.close();
+        return false;
+    }
+
+    tris = reinterpret_cast<const Tri*>(file.getData() + header->triOffset);
+    triCount = uint32_t(header->triCount);
+    bounds = Aabb(float3(header->boundsMin), float3(header->boundsMax));
+    return true;
+}
+
+bool SceneFile::save(const char* filepath, const Tri* tris, uint32_t triCount)
+{
+    Aabb bounds;
+    for (uint32_t i=0; i<triCount; i++)
+        bounds.expand(tris[i].vertex0).expand(tris[i].vertex1).expand(tris[i].vertex2);
+
+    SceneFileHeader header = {};
+    header.magic = SceneFileHeader::kMagic;
+    header.version = SceneFileHeader::kVersion;
+    header.headerSize = sizeof(SceneFileHeader);
+    header.triSize = sizeof(Tri);
+    header.triCount = triCount;
+    header.payloadAlignment = SceneFileHeader::kPayloadAlignment;
+    header.triOffset = (sizeof(SceneFileHeader) + header.payloadAlignment - 1) / header.payloadAlignment * header.payloadAlignment;
+    for (int axis=0; axis<3; axis++)
+    {
+        header.boundsMin[axis] = bounds.min[axis];
+        header.boundsMax[axis] = bounds.max[axis];
+    }
+
+    FILE* file = fopen(filepath, "wb");
+    if (!file)
+        return false;
+
+    static const uint8_t kPadding[SceneFileHeader::kPayloadAlignment] = {};
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(kPadding, 1, header.triOffset - sizeof(header), file) == header.triOffset - sizeof(header)
+        && fwrite(tris, sizeof(Tri), triCount, file) == triCount;
+
+    return fclose(file) == 0 && written;
+}
+
+bool SceneFile::convertText(const char* textFilepath, const char* filepath)
+{
+    MappedFile textFile;
+    if (!textFile.open(textFilepath))
+        return false;
+
+    const char* p = reinterpret_cast<const char*>(textFile.getData());
+    const char* end = p + textFile.getSize();
+
+    auto parseFloat = [&p, end](float& outValue)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+            p++;
+
+        std::from_chars_result result = std::from_chars(p, end, outValue);
+        p = result.ptr;
+        return result.ec == std::errc();
+    };
+
+    // roughly 90 characters per line, only used to avoid regrowing
+    std::vector<Tri> tris;
+    tris.reserve(textFile.getSize() / 80);
+
+    Tri tri;
+    bool endMarker = false;
+    while (!endMarker && parseFloat(tri.vertex0.x))
+    {
+        bool valid = parseFloat(tri.vertex0.y) && parseFloat(tri.vertex0.z)
+            && parseFloat(tri.vertex1.x) && parseFloat(tri.vertex1.y) && parseFloat(tri.vertex1.z)
+            && parseFloat(tri.vertex2.x) && parseFloat(tri.vertex2.y) && parseFloat(tri.vertex2.z);
+        if (!valid)
+            return false;
+
+        // .tri files end with a line of 999s
+        endMarker = tri.vertex0 == float3(999.0f) && tri.vertex1 == float3(999.0f) && tri.vertex2 == float3(999.0f);
+        if (endMarker)
+            continue;
+
+        tri.centroid = (tri.vertex0 + tri.vertex1 + tri.vertex2) / 3.0f;
+        tris.push_back(tri);
+    }
+
+    // stopped at something which isn't a number
+    if (!endMarker && p != end)
+        return false;
+
+    return save(filepath, tris.data(), uint32_t(tris.size()));
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "../Core/MappedFile.h"
+#include "../Math/Aabb.h"
+#include "../Math/Tri.h"
+#include <cstdint>
+
+///////////////////////////////////////////////////////////////////////////////
+// Binary scene format
+///////////////////////////////////////////////////////////////////////////////
+
+// File layout:
+//   SceneFileHeader
+//   padding up to triOffset
+//   Tri[triCount], the in-memory layout of Math::Tri with centroids filled in
+//
+// The payload is used in place from the mapped file, so a reader only accepts
+// files written with the same Tri layout and byte order.
+struct SceneFileHeader
+{
+    static constexpr uint32_t kMagic = 'T' | 'R' << 8 | 'I' << 16 | 'S' << 24;
+    static constexpr uint32_t kVersion = 1;
+    static constexpr uint32_t kPayloadAlignment = 64;
+
+    uint32_t magic;
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t triSize;               // sizeof(Tri) of the writer
+    uint64_t triCount;
+    uint64_t triOffset;             // from the start of the file, multiple of payloadAlignment
+    uint32_t payloadAlignment;
+    uint32_t reserved;
+    float boundsMin[3];
+    float boundsMax[3];
+};
+
+static_assert(sizeof(SceneFileHeader) == 64);
+static_assert(sizeof(Math::Tri) == 48, "Tri layout is part of the scene file format");
+
+
+///////////////////////////////////////////////////////////////////////////////
+// SceneFile
+///////////////////////////////////////////////////////////////////////////////
+
+// Memory mapped scene, the triangles point into the mapping and stay valid
+// while the SceneFile is alive.
+class SceneFile
+{
+    MappedFile file;
+    const Math::Tri* tris = nullptr;
+    uint32_t triCount = 0;
+    Math::Aabb bounds;
+
+public:
+    // returns false if the file is missing, truncated or of another version
+    bool load(const char* filepath);
+
+    const Math::Tri* getTris() const { return tris; }
+    uint32_t getTriCount() const { return triCount; }
+    const Math::Aabb& getBounds() const { return bounds; }
+
+    static bool save(const char* filepath, const Math::Tri* tris, uint32_t triCount);
+
+    // Converts a text file with one triangle per line (9 floats, 3 vertices)
+    // to the binary format. Returns false if the input can't be read or the
+    // output can't be written.
+    static bool convertText(const char* textFilepath, const char* filepath);
+};
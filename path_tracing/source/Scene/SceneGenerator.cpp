@@ -0,0 +1,89 @@
+#include "SceneGenerator.h"
+#include "../Util.h"
+#include <cmath>
+using namespace Math;
+
+void computeCentroids(std::vector<Tri>& triangles)
+{
+    for (Tri& tri : triangles)
+    {
+        tri.centroid = (tri.vertex0 + tri.vertex1 + tri.vertex2) / 3.0f;
+    }
+}
+
+static Tri makeTri(const float3& vertex0, const float3& vertex1, const float3& vertex2)
+{
+    return Tri{ vertex0, vertex1, vertex2, (vertex0 + vertex1 + vertex2) / 3.0f };
+}
+
+void generateRandomTris(std::vector<Tri>& triangles, uint32_t count, float triSize, uint32_t seed)
+{
+    triangles.resize(count);
+    for (Tri& tri : triangles)
+    {
+        float3 r0( RandomFloat(seed), RandomFloat(seed), RandomFloat(seed) );
+        float3 r1( RandomFloat(seed), RandomFloat(seed), RandomFloat(seed) );
+        float3 r2( RandomFloat(seed), RandomFloat(seed), RandomFloat(seed) );
+        tri.vertex0 = r0 * 9.0f - float3( 5.0f );
+        tri.vertex1 = tri.vertex0 + r1 * triSize;
+        tri.vertex2 = tri.vertex0 + r2 * triSize;
+    }
+    computeCentroids(triangles);
+}
+
+void generateSphereTris(std::vector<Tri>& triangles, float radius, uint32_t rings, uint32_t segments)
+{
+    auto vertex = [=](uint32_t ring, uint32_t segment)
+    {
+        float theta = pif * ring / rings;
+        float phi = 2.0f * pif * (segment % segments) / segments;
+        return float3( std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi) ) * radius;
+    };
+
+    triangles.clear();
+    for (uint32_t ring = 0; ring < rings; ring++)
+    {
+        for (uint32_t segment = 0; segment < segments; segment++)
+        {
+            float3 p00 = vertex(ring, segment), p01 = vertex(ring, segment + 1);
+            float3 p10 = vertex(ring + 1, segment), p11 = vertex(ring + 1, segment + 1);
+            if (ring != 0)
+                triangles.push_back(makeTri(p00, p01, p11));
+            if (ring != rings - 1)
+                triangles.push_back(makeTri(p00, p11, p10));
+        }
+    }
+}
+
+void generateTerrainTris(std::vector<Tri>& triangles, uint32_t resolution, float size, float height)
+{
+    // a few octaves of sines, deterministic so runs compare
+    auto vertex = [=](uint32_t i, uint32_t j)
+    {
+        float x = (float(i) / resolution - 0.5f) * size;
+        float z = (float(j) / resolution - 0.5f) * size;
+        float y = 0.0f;
+        float amplitude = 0.5f * height;
+        float frequency = 2.0f * pif / size;
+        for (uint32_t octave = 0; octave < 4; octave++)
+        {
+            y += amplitude * std::sin(x * frequency * 1.3f + octave) * std::cos(z * frequency - 0.7f * octave);
+            amplitude *= 0.5f;
+            frequency *= 2.1f;
+        }
+        return float3( x, y, z );
+    };
+
+    triangles.clear();
+    triangles.reserve(size_t(resolution) * resolution * 2);
+    for (uint32_t j = 0; j < resolution; j++)
+    {
+        for (uint32_t i = 0; i < resolution; i++)
+        {
+            float3 p00 = vertex(i, j), p10 = vertex(i + 1, j);
+            float3 p01 = vertex(i, j + 1), p11 = vertex(i + 1, j + 1);
+            triangles.push_back(makeTri(p00, p10, p11));
+            triangles.push_back(makeTri(p00, p11, p01));
+        }
+    }
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "../Math/Tri.h"
+#include <cstdint>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+// Procedural scenes
+///////////////////////////////////////////////////////////////////////////////
+
+// The generators replace the content of triangles and fill in the centroids.
+
+void computeCentroids(std::vector<Math::Tri>& triangles);
+
+// triangles of size up to triSize scattered in [-5, 4]^3, the same ones for the same seed
+void generateRandomTris(std::vector<Math::Tri>& triangles, uint32_t count, float triSize = 1.0f, uint32_t seed = 0x12345678);
+
+// closed UV sphere around the origin, rings x segments quads split into 2 triangles, one triangle per quad at the poles
+void generateSphereTris(std::vector<Math::Tri>& triangles, float radius, uint32_t rings, uint32_t segments);
+
+// resolution x resolution quads of a heightfield in [-size/2, size/2] on xz, rolling hills
+// of up to height on y, 2 triangles per quad
+void generateTerrainTris(std::vector<Math::Tri>& triangles, uint32_t resolution, float size, float height);
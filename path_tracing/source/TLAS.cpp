@@ -0,0 +1,356 @@
+#include "TLAS.h"
+#include "Core/Profiler.h"
+#include "Math/Intersect.h"
+#include <algorithm>
+#include <bit>
+#include <cassert>
+using namespace Math;
+
+///////////////////////////////////////////////////////////////////////////////
+// Profiling
+///////////////////////////////////////////////////////////////////////////////
+#ifdef BVH_ENABLE_PROFILING
+    #define IF_PROFILING(x) x
+#else
+    #define IF_PROFILING(x)
+#endif
+
+static constexpr uint32_t kBinCount = 8;
+
+///////////////////////////////////////////////////////////////////////////////
+// Instance
+///////////////////////////////////////////////////////////////////////////////
+
+BVHInstance::BVHInstance(const AccelStruct& blas, const float3x4& transform)
+    : blas(&blas)
+{
+    setTransform(transform);
+}
+
+void BVHInstance::setTransform(const float3x4& newTransform)
+{
+    transform = newTransform;
+    invTransform = newTransform.inverse();
+    bounds = newTransform.transformAabb(blas->getBounds());
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Construction
+///////////////////////////////////////////////////////////////////////////////
+
+static float3 getCentroid(const Aabb& bounds)
+{
+    return (bounds.min + bounds.max) * 0.5f;
+}
+
+TLAS::TLAS(Instances _instances)
+    : instances(std::move(_instances))
+{
+    rebuild();
+}
+
+void TLAS::rebuild()
+{
+    PROFILE_ZONE("TLAS build");
+
+    const uint32_t instanceCount = uint32_t(instances.size());
+    instanceRefs.resize(instanceCount);
+    for (uint32_t i=0; i<instanceCount; i++)
+        instanceRefs[i] = i;
+
+    // one instance per leaf, a full binary tree
+    nodePool.resize(instanceCount > 0 ? 2 * instanceCount - 1 : 0);
+    nodeCount = 0;
+    rootNodeIndex = 0;
+    if (instanceCount == 0)
+        return;
+
+    rootNodeIndex = nodeCount++;
+    BVHNode& root = nodePool[rootNodeIndex];
+    root.initLeafNode(0, instanceCount);
+    updateNodeBounds(root);
+    subdivideNode(root, 0);
+
+    assert(nodeCount == nodePool.size());
+}
+
+void TLAS::updateNodeBounds(BVHNode& node)
+{
+    Aabb bounds;
+    for (uint32_t i=0; i<node.itemCount; i++)
+        bounds.expand(instances[instanceRefs[node.firstItemRef() + i]].bounds);
+
+    node.aabbMin = bounds.min;
+    node.aabbMax = bounds.max;
+}
+
+void TLAS::subdivideNode(BVHNode& node, uint32_t depth)
+{
+    if (node.itemCount == 1)
+        return;
+
+    const uint32_t first = node.firstItemRef();
+    const uint32_t last = first + node.itemCount;
+
+    // skewed layouts can chain SAH splits deeper than the traversal stacks, as in
+    // BVH::subdivideNode() nodes switch to median splits once the levels left are needed
+    if (depth + std::bit_width(node.itemCount - 1) >= BVH::kMaxDepth)
+    {
+        Aabb centroidBounds;
+        for (uint32_t i=first; i<last; i++)
+            centroidBounds.expand(getCentroid(instances[instanceRefs[i]].bounds));
+
+        CoordAxis axis = maxAxis(centroidBounds.extent());
+        uint32_t childItemCount0 = (node.itemCount + 1) / 2;
+        std::nth_element(&instanceRefs[first], &instanceRefs[first] + childItemCount0, &instanceRefs[first] + node.itemCount,
+            [this, axis](uint32_t a, uint32_t b) { return getCentroid(instances[a].bounds)[axis] < getCentroid(instances[b].bounds)[axis]; });
+        emitChildren(node, childItemCount0, depth);
+        return;
+    }
+
+    Aabb centroidBounds;
+    for (uint32_t i=first; i<last; i++)
+        centroidBounds.expand(getCentroid(instances[instanceRefs[i]].bounds));
+
+    // binned SAH over the instance centroids
+    struct Bin
+    {
+        Aabb bounds;
+        uint32_t count = 0;
+    };
+
+    int bestAxis = -1;
+    uint32_t bestSplit = 0;
+    float bestCost = Ray::kInf;
+    for (uint8_t axis = 0; axis < CoordAxis_Count; axis++)
+    {
+        float boundsMin = centroidBounds.min[axis];
+        float boundsMax = centroidBounds.max[axis];
+        if (boundsMin == boundsMax)
+            continue;
+
+        Bin bins[kBinCount];
+        float scale = kBinCount / (boundsMax - boundsMin);
+        for (uint32_t i=first; i<last; i++)
+        {
+            const Aabb& bounds = instances[instanceRefs[i]].bounds;
+            uint32_t binIndex = std::min(kBinCount - 1, uint32_t((getCentroid(bounds)[axis] - boundsMin) * scale));
+            bins[binIndex].bounds.expand(bounds);
+            bins[binIndex].count++;
+        }
+
+        // areas and counts left of each split, then sweep from the right
+        float leftArea[kBinCount - 1];
+        uint32_t leftCount[kBinCount - 1];
+        Aabb leftBounds;
+        uint32_t leftSum = 0;
+        for (uint32_t i=0; i<kBinCount - 1; i++)
+        {
+            leftSum += bins[i].count;
+            leftBounds.expand(bins[i].bounds);
+            leftCount[i] = leftSum;
+            leftArea[i] = leftBounds.area();
+        }
+
+        Aabb rightBounds;
+        uint32_t rightSum = 0;
+        for (uint32_t i=kBinCount - 1; i>0; i--)
+        {
+            rightSum += bins[i].count;
+            rightBounds.expand(bins[i].bounds);
+            if (leftCount[i - 1] == 0 || rightSum == 0)
+                continue;
+
+            float cost = leftCount[i - 1] * leftArea[i - 1] + rightSum * rightBounds.area();
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = i;
+            }
+        }
+    }
+
+    // a leaf holds a single instance, instances on the same centroid are split by count
+    uint32_t childItemCount0;
+    if (bestAxis >= 0)
+    {
+        float boundsMin = centroidBounds.min[bestAxis];
+        float scale = kBinCount / (centroidBounds.max[bestAxis] - boundsMin);
+        uint32_t* split = std::partition(&instanceRefs[first], &instanceRefs[first] + node.itemCount, [&](uint32_t instanceIndex)
+        {
+            float centroid = getCentroid(instances[instanceIndex].bounds)[bestAxis];
+            return std::min(kBinCount - 1, uint32_t((centroid - boundsMin) * scale)) < bestSplit;
+        });
+        childItemCount0 = uint32_t(split - &instanceRefs[first]);
+    }
+    else
+    {
+        childItemCount0 = node.itemCount / 2;
+    }
+    emitChildren(node, childItemCount0, depth);
+}
+
+// the first childItemCount0 instance refs of node go to child0, the rest to child1
+void TLAS::emitChildren(BVHNode& node, uint32_t childItemCount0, uint32_t depth)
+{
+    assert(childItemCount0 > 0 && childItemCount0 < node.itemCount);
+    const uint32_t first = node.firstItemRef();
+
+    uint32_t childIndex0 = nodeCount;
+    nodeCount += 2;
+
+    BVHNode& child0 = nodePool[childIndex0];
+    child0.initLeafNode(first, childItemCount0);
+    updateNodeBounds(child0);
+
+    BVHNode& child1 = nodePool[childIndex0 + 1];
+    child1.initLeafNode(first + childItemCount0, node.itemCount - childItemCount0);
+    updateNodeBounds(child1);
+
+    node.initInternalNode(childIndex0);
+
+    subdivideNode(child0, depth + 1);
+    subdivideNode(child1, depth + 1);
+}
+
+Aabb TLAS::getBounds() const
+{
+    if (nodePool.empty())
+        return Aabb();
+    return Aabb(nodePool[rootNodeIndex].aabbMin, nodePool[rootNodeIndex].aabbMax);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Intersection
+///////////////////////////////////////////////////////////////////////////////
+
+// The direction isn't normalized in object space, so distances along the
+// object space ray are the same as along the world space ray. Scaled instances
+// scale the determinant the Moller-Trumbore kernel compares to its epsilon too.
+void TLAS::intersectInstance(Ray& ray, uint32_t instanceIndex, BVHStats& stats) const
+{
+    const BVHInstance& instance = instances[instanceIndex];
+
+    Ray objectRay(instance.invTransform.transformPoint(ray.O), instance.invTransform.transformVector(ray.D));
+    objectRay.hit = ray.hit;
+
+    instance.blas->intersect(objectRay, stats);
+
+    if (objectRay.hit.t < ray.hit.t)
+    {
+        ray.hit = objectRay.hit;
+        ray.hit.instId = instanceIndex;
+    }
+}
+
+bool TLAS::occludedInstance(const Ray& ray, uint32_t instanceIndex, BVHStats& stats) const
+{
+    const BVHInstance& instance = instances[instanceIndex];
+
+    Ray objectRay(instance.invTransform.transformPoint(ray.O), instance.invTransform.transformVector(ray.D), ray.hit.t);
+    return instance.blas->occluded(objectRay, stats);
+}
+
+// Same front-to-back traversal as BVH::intersect(), the leaves descend into the BLASes
+void TLAS::intersect(Ray& ray, BVHStats& stats) const
+{
+    if (nodePool.empty())
+        return;
+
+    const BVHNode* node = &nodePool[rootNodeIndex];
+
+    IF_PROFILING(stats.intersectRayAabbCount++);
+    if (intersectRayAabb(ray, node->aabbMin, node->aabbMax) == Ray::kInf)
+        return;
+
+    const BVHNode* stack[BVH::kMaxDepth];
+    uint32_t stackPtr = 0;
+
+    while (1)
+    {
+        if (node->isLeaf())
+        {
+            for (uint32_t i=0; i<node->itemCount; i++)
+                intersectInstance(ray, instanceRefs[node->firstItemRef() + i], stats);
+
+            if (stackPtr == 0)
+                break;
+            node = stack[--stackPtr];
+            continue;
+        }
+
+        const BVHNode* child0 = &nodePool[node->firstChild()];
+        const BVHNode* child1 = &nodePool[node->firstChild() + 1];
+        float dist0 = intersectRayAabb(ray, child0->aabbMin, child0->aabbMax);
+        float dist1 = intersectRayAabb(ray, child1->aabbMin, child1->aabbMax);
+        IF_PROFILING(stats.intersectRayAabbCount += 2);
+
+        if (dist0 > dist1)
+        {
+            std::swap(dist0, dist1);
+            std::swap(child0, child1);
+        }
+
+        if (dist0 == Ray::kInf)
+        {
+            if (stackPtr == 0)
+                break;
+            node = stack[--stackPtr];
+        }
+        else
+        {
+            node = child0;
+            if (dist1 != Ray::kInf) stack[stackPtr++] = child1;
+        }
+    }
+}
+
+bool TLAS::occluded(const Ray& ray, BVHStats& stats) const
+{
+    if (nodePool.empty())
+        return false;
+
+    const BVHNode* node = &nodePool[rootNodeIndex];
+
+    IF_PROFILING(stats.intersectRayAabbCount++);
+    if (intersectRayAabb(ray, node->aabbMin, node->aabbMax) == Ray::kInf)
+        return false;
+
+    const BVHNode* stack[BVH::kMaxDepth];
+    uint32_t stackPtr = 0;
+
+    while (1)
+    {
+        if (node->isLeaf())
+        {
+            for (uint32_t i=0; i<node->itemCount; i++)
+            {
+                if (occludedInstance(ray, instanceRefs[node->firstItemRef() + i], stats))
+                    return true;
+            }
+        }
+        else
+        {
+            const BVHNode* child0 = &nodePool[node->firstChild()];
+            const BVHNode* child1 = &nodePool[node->firstChild() + 1];
+            bool hit0 = intersectRayAabb(ray, child0->aabbMin, child0->aabbMax) != Ray::kInf;
+            bool hit1 = intersectRayAabb(ray, child1->aabbMin, child1->aabbMax) != Ray::kInf;
+            IF_PROFILING(stats.intersectRayAabbCount += 2);
+
+            if (hit0 || hit1)
+            {
+                node = hit0 ? child0 : child1;
+                if (hit0 && hit1) stack[stackPtr++] = child1;
+                continue;
+            }
+        }
+
+        if (stackPtr == 0)
+            return false;
+
+        node = stack[--stackPtr];
+    }
+}
@@ -0,0 +1,83 @@
+// Two-level acceleration structure: a top-level BVH over instances, each
+// placing a bottom-level acceleration structure with an affine transform.
+
+#pragma once
+
+#include "BVH.h"
+#include "Math/Transform.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Instance
+///////////////////////////////////////////////////////////////////////////////
+
+// The BLAS is shared between instances and has to outlive them. Its hits
+// report primId in the BLAS's items, the TLAS adds the instance index as instId.
+struct BVHInstance
+{
+    const AccelStruct* blas;
+    Math::float3x4 transform;       // object to world
+    Math::float3x4 invTransform;    // world to object, rays are moved into the BLAS's space
+    Math::Aabb bounds;              // of the transformed BLAS bounds, in world space
+
+    BVHInstance(const AccelStruct& blas, const Math::float3x4& transform);
+
+    void setTransform(const Math::float3x4& transform);
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// TLAS
+///////////////////////////////////////////////////////////////////////////////
+
+// Binned SAH BVH over the instance bounds with one instance per leaf. Instances
+// are few compared to triangles, moving some of them is followed by a rebuild
+// of the top level only.
+class TLAS final : public AccelStruct
+{
+public:
+    using Instances = std::vector<BVHInstance>;
+    using InstanceRefs = std::vector<uint32_t>;
+    using NodePool = std::vector<BVHNode>;
+
+private:
+    Instances instances;
+    InstanceRefs instanceRefs;      // leaves index into these, in the order of the tree
+
+    NodePool nodePool;
+    uint32_t rootNodeIndex;
+    uint32_t nodeCount;
+
+    void updateNodeBounds(BVHNode& node);
+    void subdivideNode(BVHNode& node, uint32_t depth);
+    void emitChildren(BVHNode& node, uint32_t childItemCount0, uint32_t depth);
+
+    void intersectInstance(Math::Ray& ray, uint32_t instanceIndex, BVHStats& stats) const;
+    bool occludedInstance(const Math::Ray& ray, uint32_t instanceIndex, BVHStats& stats) const;
+
+public:
+    explicit TLAS(Instances instances);
+
+    const Instances& getInstances() const { return instances; }
+    uint32_t getInstanceCount() const { return uint32_t(instances.size()); }
+    const BVHInstance& getInstance(uint32_t instanceIndex) const { return instances[instanceIndex]; }
+    const NodePool& getNodes() const { return nodePool; }
+    uint32_t getRootNodeIndex() const { return rootNodeIndex; }
+
+    // takes effect with the next rebuild()
+    void setTransform(uint32_t instanceIndex, const Math::float3x4& transform) { instances[instanceIndex].setTransform(transform); }
+
+    // rebuilds the top level over the current instance bounds, the BLASes are untouched
+    void rebuild();
+
+    // AccelStruct
+    const char* getName() const override { return "TLAS"; }
+    uint32_t getNodeCount() const override { return uint32_t(nodePool.size()); }
+    size_t getNodeMemorySize() const override { return nodePool.size() * sizeof(BVHNode) + instances.size() * sizeof(BVHInstance); }
+    Math::Aabb getBounds() const override;
+
+    using AccelStruct::intersect;
+    void intersect(Math::Ray& ray, BVHStats& stats) const override;
+
+    using AccelStruct::occluded;
+    bool occluded(const Math::Ray& ray, BVHStats& stats) const override;
+};
@@ -1,4 +1,4 @@
-#include "util.h"
+#include "Util.h"
 
 // RNG - Marsaglia's xor32
 static uint32_t seed = 0x12345678;
@@ -19,4 +19,50 @@ uint32_t RandomUInt( uint32_t& seed )
 	seed ^= seed << 5;
 	return seed;
 }
-float RandomFloat( uint32_t& seed ) { return RandomUInt( seed ) * 2.3283064365387e-10f; }
\ No newline at end of file
+float RandomFloat( uint32_t& seed ) { return RandomUInt( seed ) * 2.3283064365387e-10f; }
+// seeds for the local RNG, decorrelated per pixel / sample
+uint32_t WangHash( uint32_t s )
+{
+	s = (s ^ 61) ^ (s >> 16);
+	s *= 9, s = s ^ (s >> 4);
+	s *= 0x27d4eb2d;
+	s = s ^ (s >> 15);
+	return s;
+}
+uint32_t InitSeed( uint32_t seedBase )
+{
+	// xor32 gets stuck on 0
+	return WangHash( (seedBase + 1) * 17 ) | 1;
+}
+
+void RadixSort( std::vector<uint64_t>& keys, std::vector<uint32_t>& values, uint32_t keyBits )
+{
+	const size_t count = keys.size();
+	std::vector<uint64_t> tempKeys( count );
+	std::vector<uint32_t> tempValues( count );
+
+	for (uint32_t shift = 0; shift < keyBits; shift += 8)
+	{
+		uint32_t offsets[256] = {};
+		for (size_t i = 0; i < count; i++)
+			offsets[(keys[i] >> shift) & 0xff]++;
+
+		uint32_t sum = 0;
+		for (uint32_t& offset : offsets)
+		{
+			uint32_t digitCount = offset;
+			offset = sum;
+			sum += digitCount;
+		}
+
+		for (size_t i = 0; i < count; i++)
+		{
+			uint32_t dst = offsets[(keys[i] >> shift) & 0xff]++;
+			tempKeys[dst] = keys[i];
+			tempValues[dst] = values[i];
+		}
+
+		keys.swap( tempKeys );
+		values.swap( tempValues );
+	}
+}
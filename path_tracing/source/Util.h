@@ -7,6 +7,18 @@ float RandomFloat();
 float Rand( float range );
 uint32_t RandomUInt( uint32_t& seed );
 float RandomFloat( uint32_t& seed );
+uint32_t WangHash( uint32_t s );
+uint32_t InitSeed( uint32_t seedBase );
+
+
+////////////////////////////////////////////////////////////////////
+// Sorting
+////////////////////////////////////////////////////////////////////
+#include <vector>
+
+// LSD radix sort of (key, value) pairs, 8 bits per pass. Only the passes
+// covering keyBits are done. Uses temp buffers of the same size.
+void RadixSort( std::vector<uint64_t>& keys, std::vector<uint32_t>& values, uint32_t keyBits );
 
 
 ////////////////////////////////////////////////////////////////////
@@ -34,4 +46,13 @@ public:
         std::chrono::milliseconds duration = std::chrono::duration_cast<std::chrono::milliseconds>(current - start);
         return duration.count();
     }
+
+    // fractional milliseconds, for phases too short for duration()
+    double elapsedMs() const
+    {
+        time_point current = clock::now();
+
+        std::chrono::duration<double, std::milli> duration = current - start;
+        return duration.count();
+    }
 };
\ No newline at end of file
@@ -0,0 +1,300 @@
+#include "WideBVH.h"
+#include "Core/Profiler.h"
+#include "Math/Aabb.h"
+#include "Math/Intersect.h"
+#include <cassert>
+#include <limits>
+using namespace Math;
+
+///////////////////////////////////////////////////////////////////////////////
+// Profiling
+///////////////////////////////////////////////////////////////////////////////
+#ifdef BVH_ENABLE_PROFILING
+    #define IF_PROFILING(x) x
+#else
+    #define IF_PROFILING(x)
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Construction
+///////////////////////////////////////////////////////////////////////////////
+
+static float getArea(const BVHNode& node)
+{
+    return Aabb(node.aabbMin, node.aabbMax).area();
+}
+
+uint32_t openBinaryChildren(const BVH::NodePool& binaryNodes, uint32_t* children, uint32_t childCount, uint32_t maxChildCount)
+{
+    while (childCount < maxChildCount)
+    {
+        int bestChild = -1;
+        float bestArea = -1.0f;
+        for (uint32_t i=0; i<childCount; i++)
+        {
+            const BVHNode& binaryNode = binaryNodes[children[i]];
+            if (!binaryNode.isLeaf() && getArea(binaryNode) > bestArea)
+            {
+                bestChild = int(i);
+                bestArea = getArea(binaryNode);
+            }
+        }
+
+        if (bestChild < 0)
+            break;
+
+        uint32_t firstChild = binaryNodes[children[bestChild]].firstChild();
+        children[bestChild] = firstChild;
+        children[childCount++] = firstChild + 1;
+    }
+    return childCount;
+}
+
+template <uint32_t N>
+WideBVH<N>::WideBVH(const BVH& bvh)
+    : items(bvh.getItems())
+    , itemRefs(bvh.getItemRefs())
+    , triBlocks(bvh.getTriBlocks())
+    , triVertexBlocks(bvh.getTriVertexBlocks())
+    , triKernel(bvh.getBuildParams().triKernel)
+    , bounds(bvh.getBounds())
+{
+    PROFILE_ZONE("BVH collapse");
+
+    const BVH::NodePool& binaryNodes = bvh.getNodes();
+    const BVHNode& binaryRoot = binaryNodes[bvh.getRootNodeIndex()];
+
+    // a wide node has at most one node per binary node with 2 or more children
+    nodePool.reserve(binaryNodes.size() / 2 + 1);
+
+    if (binaryRoot.isLeaf())
+    {
+        uint32_t rootChild = bvh.getRootNodeIndex();
+        rootNodeIndex = collapseNode(binaryNodes, &rootChild, 1);
+    }
+    else
+    {
+        uint32_t rootChildren[2] = { binaryRoot.firstChild(), binaryRoot.firstChild() + 1 };
+        rootNodeIndex = collapseNode(binaryNodes, rootChildren, 2);
+    }
+
+    IF_PROFILING(stats.reorderNodes = true);
+}
+
+// Creates a wide node from binary children, opened up until the node is full.
+// Returns the wide node index.
+template <uint32_t N>
+uint32_t WideBVH<N>::collapseNode(const BVH::NodePool& binaryNodes, const uint32_t* binaryChildren, uint32_t binaryChildCount)
+{
+    uint32_t children[N];
+    for (uint32_t i=0; i<binaryChildCount; i++)
+        children[i] = binaryChildren[i];
+    uint32_t childCount = openBinaryChildren(binaryNodes, children, binaryChildCount, N);
+
+    uint32_t nodeIndex = uint32_t(nodePool.size());
+    nodePool.emplace_back();
+
+    // recursion may reallocate the pool, fill a local node and copy it at the end
+    Node node;
+    const float kNaN = std::numeric_limits<float>::quiet_NaN();
+    for (uint32_t i=0; i<N; i++)
+    {
+        if (i >= childCount)
+        {
+            for (uint8_t axis = 0; axis < CoordAxis_Count; axis++)
+            {
+                node.childMin[axis][i] = kNaN;
+                node.childMax[axis][i] = kNaN;
+            }
+            node.child[i] = 0;
+            node.childItemCount[i] = 0;
+            continue;
+        }
+
+        const BVHNode& binaryNode = binaryNodes[children[i]];
+        for (uint8_t axis = 0; axis < CoordAxis_Count; axis++)
+        {
+            node.childMin[axis][i] = binaryNode.aabbMin[axis];
+            node.childMax[axis][i] = binaryNode.aabbMax[axis];
+        }
+
+        if (binaryNode.isLeaf())
+        {
+            node.child[i] = binaryNode.firstItemRef();
+            node.childItemCount[i] = binaryNode.itemCount;
+        }
+        else
+        {
+            uint32_t grandChildren[2] = { binaryNode.firstChild(), binaryNode.firstChild() + 1 };
+            node.child[i] = collapseNode(binaryNodes, grandChildren, 2);
+            node.childItemCount[i] = 0;
+        }
+    }
+
+    nodePool[nodeIndex] = node;
+    return nodeIndex;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Traversal
+///////////////////////////////////////////////////////////////////////////////
+
+template <uint32_t N>
+void WideBVH<N>::intersectLeaf(Math::Ray& ray, const Math::RaySimd4& ray4, uint32_t firstItemRef, uint32_t itemCount) const
+{
+#ifdef BVH_USE_TRI_BLOCKS
+    if (triKernel == BVHTriKernel_Watertight)
+        intersectRayTriBlocks(ray, ray4, triVertexBlocks.data(), firstItemRef, itemCount);
+    else
+        intersectRayTriBlocks(ray, ray4, triBlocks.data(), firstItemRef, itemCount);
+#else
+    for (uint32_t i=0; i<itemCount; i++)
+    {
+        uint32_t itemIndex = itemRefs[firstItemRef + i];
+        if (triKernel == BVHTriKernel_Watertight)
+            intersectRayTriWatertight(ray, ray4.shear, items[itemIndex], itemIndex);
+        else
+            intersectRayTri(ray, items[itemIndex], itemIndex);
+    }
+#endif
+}
+
+template <uint32_t N>
+bool WideBVH<N>::occludedLeaf(const Math::Ray& ray, const Math::RaySimd4& ray4, uint32_t firstItemRef, uint32_t itemCount) const
+{
+#ifdef BVH_USE_TRI_BLOCKS
+    if (triKernel == BVHTriKernel_Watertight)
+        return occludeRayTriBlocks(ray, ray4, triVertexBlocks.data(), firstItemRef, itemCount);
+    else
+        return occludeRayTriBlocks(ray, ray4, triBlocks.data(), firstItemRef, itemCount);
+#else
+    for (uint32_t i=0; i<itemCount; i++)
+    {
+        const Item& item = items[itemRefs[firstItemRef + i]];
+        bool hit = triKernel == BVHTriKernel_Watertight ? occludeRayTriWatertight(ray, ray4.shear, item) : occludeRayTri(ray, item);
+        if (hit)
+            return true;
+    }
+    return false;
+#endif
+}
+
+template <uint32_t N>
+void WideBVH<N>::intersect(Math::Ray& ray, BVHStats& stats) const
+{
+    struct StackEntry
+    {
+        float dist;
+        uint32_t child;
+        uint32_t itemCount;
+    };
+
+    RaySimd4 ray4(ray, triKernel == BVHTriKernel_Watertight);
+
+    StackEntry stack[BVH::kMaxDepth * N];
+    uint32_t stackPtr = 0;
+
+    const Node* node = &nodePool[rootNodeIndex];
+    while (1)
+    {
+        // test all children, 4 at a time
+        float dist[N];
+        for (uint32_t i=0; i<N; i+=4)
+        {
+            simd4f bmin[3] = { simd4f::load(&node->childMin[0][i]), simd4f::load(&node->childMin[1][i]), simd4f::load(&node->childMin[2][i]) };
+            simd4f bmax[3] = { simd4f::load(&node->childMax[0][i]), simd4f::load(&node->childMax[1][i]), simd4f::load(&node->childMax[2][i]) };
+            intersectRayAabb4(ray4, ray.hit.t, bmin, bmax).store(&dist[i]);
+        }
+        IF_PROFILING(stats.intersectRayAabbCount += N);
+
+        // sort hit children by distance, farthest first, and push them so the nearest is popped first
+        StackEntry hits[N];
+        uint32_t hitCount = 0;
+        for (uint32_t i=0; i<N; i++)
+        {
+            if (dist[i] == Ray::kInf)
+                continue;
+
+            StackEntry entry = { dist[i], node->child[i], node->childItemCount[i] };
+            uint32_t j = hitCount++;
+            for (; j > 0 && hits[j - 1].dist < entry.dist; j--)
+                hits[j] = hits[j - 1];
+            hits[j] = entry;
+        }
+        for (uint32_t i=0; i<hitCount; i++)
+            stack[stackPtr++] = hits[i];
+
+        // pop until we find an internal node, intersecting leaves on the way
+        node = nullptr;
+        while (stackPtr > 0)
+        {
+            const StackEntry& entry = stack[--stackPtr];
+
+            // a closer hit was found since this child was pushed
+            if (entry.dist >= ray.hit.t)
+                continue;
+
+            if (entry.itemCount == 0)
+            {
+                node = &nodePool[entry.child];
+                break;
+            }
+
+            intersectLeaf(ray, ray4, entry.child, entry.itemCount);
+            IF_PROFILING(stats.intersectRayTriCount += entry.itemCount);
+        }
+
+        if (!node)
+            break;
+    }
+}
+
+template <uint32_t N>
+bool WideBVH<N>::occluded(const Math::Ray& ray, BVHStats& stats) const
+{
+    RaySimd4 ray4(ray, triKernel == BVHTriKernel_Watertight);
+
+    // only internal nodes are pushed
+    uint32_t stack[BVH::kMaxDepth * N];
+    uint32_t stackPtr = 0;
+
+    const Node* node = &nodePool[rootNodeIndex];
+    while (1)
+    {
+        float dist[N];
+        for (uint32_t i=0; i<N; i+=4)
+        {
+            simd4f bmin[3] = { simd4f::load(&node->childMin[0][i]), simd4f::load(&node->childMin[1][i]), simd4f::load(&node->childMin[2][i]) };
+            simd4f bmax[3] = { simd4f::load(&node->childMax[0][i]), simd4f::load(&node->childMax[1][i]), simd4f::load(&node->childMax[2][i]) };
+            intersectRayAabb4(ray4, ray.hit.t, bmin, bmax).store(&dist[i]);
+        }
+        IF_PROFILING(stats.intersectRayAabbCount += N);
+
+        // leaves are tested right away, a hit there ends the query before any node is pushed
+        for (uint32_t i=0; i<N; i++)
+        {
+            if (dist[i] == Ray::kInf)
+                continue;
+
+            if (node->isLeaf(i))
+            {
+                IF_PROFILING(stats.intersectRayTriCount += node->childItemCount[i]);
+                if (occludedLeaf(ray, ray4, node->child[i], node->childItemCount[i]))
+                    return true;
+            }
+            else
+            {
+                stack[stackPtr++] = node->child[i];
+            }
+        }
+
+        if (stackPtr == 0)
+            return false;
+
+        node = &nodePool[stack[--stackPtr]];
+    }
+}
+
+template class WideBVH<4>;
+template class WideBVH<8>;
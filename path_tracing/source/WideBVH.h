@@ -0,0 +1,86 @@
+// Wide BVH collapsed from the binary BVH, so one node visit tests several children.
+// https://www.embree.org/papers/2008-EGSR-QBVH.pdf
+
+#pragma once
+
+#include "BVH.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Node
+///////////////////////////////////////////////////////////////////////////////
+
+// Child bounds are stored SoA, one SIMD slab test covers 4 children.
+// Unused child slots have NaN bounds which never pass the slab test.
+template <uint32_t N>
+struct WideBVHNode
+{
+    static_assert(N % 4 == 0);
+    static constexpr uint32_t kChildCount = N;
+
+    float childMin[3][N];
+    float childMax[3][N];
+    uint32_t child[N];              // node index, or first item ref for leaves
+    uint32_t childItemCount[N];     // 0 for internal nodes
+
+    bool isLeaf(uint32_t i) const { return childItemCount[i] > 0; }
+};
+static_assert(sizeof(WideBVHNode<4>) == 128);
+static_assert(sizeof(WideBVHNode<8>) == 256);
+
+
+///////////////////////////////////////////////////////////////////////////////
+// WideBVH
+///////////////////////////////////////////////////////////////////////////////
+
+// Keeps replacing the internal child with the largest surface area by its two
+// children until there are maxChildCount children or only leaves are left.
+// children has room for maxChildCount entries, returns the new child count.
+uint32_t openBinaryChildren(const BVH::NodePool& binaryNodes, uint32_t* children, uint32_t childCount, uint32_t maxChildCount);
+
+template <uint32_t N>
+class WideBVH final : public AccelStruct
+{
+public:
+    using Item = BVH::Item;
+    using Node = WideBVHNode<N>;
+    using NodePool = std::vector<Node>;
+
+private:
+    // items, shared with the binary BVH, item refs and triangle blocks are copied
+    const Item* items;
+    BVH::ItemRefs itemRefs;
+    BVH::TriBlocks triBlocks;
+    BVH::TriVertexBlocks triVertexBlocks;
+    BVHTriKernel triKernel;
+
+    // nodes
+    NodePool nodePool;
+    uint32_t rootNodeIndex;
+    Math::Aabb bounds;              // of the binary root, wide nodes only keep child bounds
+
+    uint32_t collapseNode(const BVH::NodePool& binaryNodes, const uint32_t* binaryChildren, uint32_t binaryChildCount);
+
+    void intersectLeaf(Math::Ray& ray, const Math::RaySimd4& ray4, uint32_t firstItemRef, uint32_t itemCount) const;
+    bool occludedLeaf(const Math::Ray& ray, const Math::RaySimd4& ray4, uint32_t firstItemRef, uint32_t itemCount) const;
+
+public:
+    explicit WideBVH(const BVH& bvh);
+
+    // AccelStruct
+    const char* getName() const override { return N == 4 ? "BVH4" : "BVH8"; }
+    uint32_t getNodeCount() const override { return uint32_t(nodePool.size()); }
+    size_t getNodeMemorySize() const override { return nodePool.size() * sizeof(Node); }
+    Math::Aabb getBounds() const override { return bounds; }
+
+    using AccelStruct::intersect;
+    void intersect(Math::Ray& ray, BVHStats& stats) const override;
+
+    using AccelStruct::occluded;
+    bool occluded(const Math::Ray& ray, BVHStats& stats) const override;
+};
+
+extern template class WideBVH<4>;
+extern template class WideBVH<8>;
+
+using BVH4 = WideBVH<4>;
+using BVH8 = WideBVH<8>;
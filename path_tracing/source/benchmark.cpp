@@ -0,0 +1,564 @@
+#include "Core/PerfCounters.h"
+#include "Core/Profiler.h"
+#include "Core/TaskSystem.h"
+#include "Render/Camera.h"
+#include "Scene/SceneFile.h"
+#include "Scene/SceneGenerator.h"
+#include "BVH.h"
+#include "QuantizedBVH.h"
+#include "Util.h"
+#include "WideBVH.h"
+using namespace Math;
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <span>
+#include <string>
+
+// Builds BVHs over a suite of scenes and traces primary rays through them,
+// repeating every measurement. Results go to stdout and optionally to JSON / CSV
+// files, so runs of different commits can be compared.
+//
+// usage: benchmark [--repeat N] [--scenes name,name,...] [--size WxH] [--threads N]
+//                  [--assets dir] [--label text] [--json file] [--csv file]
+
+///////////////////////////////////////////////////////////////////////////////
+// Options
+///////////////////////////////////////////////////////////////////////////////
+
+// zones are recorded around the timed builds and traces, runs with it on aren't
+// comparable with runs without
+#ifdef PROFILER_ENABLED
+static constexpr bool kProfilerEnabled = true;
+#else
+static constexpr bool kProfilerEnabled = false;
+#endif
+
+struct Options
+{
+    uint32_t repeatCount = 5;
+    uint32_t width = 640;
+    uint32_t height = 640;
+    uint32_t threadCount = 0;           // of the build, 0 builds serially
+    std::string sceneFilter;            // comma separated scene names, empty runs all
+    std::string assetsPath = "../../assets";
+    std::string label;                  // stored with the results, e.g. a commit hash
+    std::string jsonFilepath;
+    std::string csvFilepath;
+};
+
+static bool parseOptions(int argc, char** argv, Options& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!value)
+        {
+            std::cerr << "missing value for " << arg << "\n";
+            return false;
+        }
+        i++;
+
+        if (!strcmp(arg, "--repeat"))
+            options.repeatCount = std::max(1, atoi(value));
+        else if (!strcmp(arg, "--scenes"))
+            options.sceneFilter = value;
+        else if (!strcmp(arg, "--size"))
+        {
+            if (sscanf(value, "%ux%u", &options.width, &options.height) != 2 || options.width == 0 || options.height == 0)
+            {
+                std::cerr << "invalid size " << value << ", expected WxH\n";
+                return false;
+            }
+        }
+        else if (!strcmp(arg, "--threads"))
+            options.threadCount = uint32_t(std::max(0, atoi(value)));
+        else if (!strcmp(arg, "--assets"))
+            options.assetsPath = value;
+        else if (!strcmp(arg, "--label"))
+            options.label = value;
+        else if (!strcmp(arg, "--json"))
+            options.jsonFilepath = value;
+        else if (!strcmp(arg, "--csv"))
+            options.csvFilepath = value;
+        else
+        {
+            std::cerr << "unknown option " << arg << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool isSceneSelected(const Options& options, const char* name)
+{
+    if (options.sceneFilter.empty())
+        return true;
+
+    std::string filter = "," + options.sceneFilter + ",";
+    return filter.find("," + std::string(name) + ",") != std::string::npos;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Scenes
+///////////////////////////////////////////////////////////////////////////////
+
+struct Scene
+{
+    std::vector<Tri> generatedTris;
+    SceneFile sceneFile;
+    std::span<const Tri> tris;
+    Camera cam;
+};
+
+struct SceneDesc
+{
+    const char* name;
+    std::function<bool(const Options&, Scene&)> init;
+};
+
+static const Camera kRandomTrisCamera = { float3( 0, 0, -18 ), float3( -1, 1, -15 ), float3( 1, 1, -15 ), float3( -1, -1, -15 ) };
+
+static const SceneDesc kScenes[] =
+{
+    { "random1k", [](const Options&, Scene& scene)
+        {
+            generateRandomTris(scene.generatedTris, 1024, 1.0f);
+            scene.cam = kRandomTrisCamera;
+            return true;
+        } },
+    { "random64k", [](const Options&, Scene& scene)
+        {
+            generateRandomTris(scene.generatedTris, 64 * 1024, 0.3f);
+            scene.cam = kRandomTrisCamera;
+            return true;
+        } },
+    { "random1m", [](const Options&, Scene& scene)
+        {
+            generateRandomTris(scene.generatedTris, 1024 * 1024, 0.1f);
+            scene.cam = kRandomTrisCamera;
+            return true;
+        } },
+    { "unity", [](const Options& options, Scene& scene)
+        {
+            std::string textFilepath = options.assetsPath + "/unity.tri";
+            std::string filepath = options.assetsPath + "/unity.trib";
+            if (!scene.sceneFile.load(filepath.c_str()))
+            {
+                if (!SceneFile::convertText(textFilepath.c_str(), filepath.c_str()) || !scene.sceneFile.load(filepath.c_str()))
+                {
+                    std::cerr << "failed to load scene " << textFilepath << "\n";
+                    return false;
+                }
+            }
+            scene.tris = std::span<const Tri>(scene.sceneFile.getTris(), scene.sceneFile.getTriCount());
+            scene.cam = Camera{ float3( -1.5f, -0.2f, -2.5f ), float3( -2.5f, 0.8f, -0.5f ), float3( -0.5f, 0.8f, -0.5f ), float3( -2.5f, -1.2f, -0.5f ) };
+            return true;
+        } },
+    { "sphere1m", [](const Options&, Scene& scene)
+        {
+            // large radius, intersectRayTri's determinant epsilon is absolute
+            generateSphereTris(scene.generatedTris, 100.0f, 512, 1024);
+            scene.cam = Camera::lookAt(float3( 50.0f, 80.0f, -300.0f ), float3( 0.0f ), 0.4f);
+            return true;
+        } },
+    { "terrain2m", [](const Options&, Scene& scene)
+        {
+            generateTerrainTris(scene.generatedTris, 1024, 100.0f, 10.0f);
+            scene.cam = Camera::lookAt(float3( 0.0f, 25.0f, -60.0f ), float3( 0.0f, 0.0f, 10.0f ), 0.6f);
+            return true;
+        } },
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Measurements
+///////////////////////////////////////////////////////////////////////////////
+
+struct Summary
+{
+    double median = 0.0;
+    double min = 0.0;
+    double stddev = 0.0;    // sample standard deviation, 0 for a single run
+};
+
+static Summary summarize(std::vector<double> values)
+{
+    Summary summary;
+    if (values.empty())
+        return summary;
+
+    std::sort(values.begin(), values.end());
+    size_t n = values.size();
+    summary.median = n % 2 ? values[n / 2] : 0.5 * (values[n / 2 - 1] + values[n / 2]);
+    summary.min = values.front();
+
+    if (n > 1)
+    {
+        double mean = 0.0;
+        for (double v : values)
+            mean += v;
+        mean /= double(n);
+
+        double sumSqr = 0.0;
+        for (double v : values)
+            sumSqr += (v - mean) * (v - mean);
+        summary.stddev = std::sqrt(sumSqr / double(n - 1));
+    }
+    return summary;
+}
+
+struct Result
+{
+    std::string scene;
+    uint32_t triCount = 0;
+    std::string build;
+    std::string accel;
+    uint32_t nodeCount = 0;
+    size_t nodeBytes = 0;
+    uint32_t hitCount = 0;
+    Summary buildMs;        // binary build, plus the collapse for wide and quantized trees
+    Summary traceMs;
+    Summary mrays;
+
+    // of the trace, divided by the ray count, only where the counter could be read
+    uint32_t perfCounterMask = 0;
+    Summary perRay[PerfCounter_Count];
+};
+
+// JSON keys and CSV columns
+static const char* kPerfCounterKeys[PerfCounter_Count] = { "task_clock_ns", "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses" };
+
+static std::string describeBuild(const BVHBuildParams& buildParams)
+{
+    std::string desc = toString(buildParams.method);
+    if (buildParams.method == BVHBuildMethod_BinnedSAH)
+        desc += " (" + std::to_string(buildParams.binCount) + " bins)";
+    if (buildParams.method == BVHBuildMethod_LBVH)
+        desc += " (" + std::to_string(buildParams.mortonBits) + "-bit Morton codes)";
+    if (buildParams.method == BVHBuildMethod_SBVH)
+        desc += " (" + std::to_string(buildParams.binCount) + " bins)";
+    if (buildParams.layout != BVHNodeLayout_Build)
+        desc += std::string(" ") + toString(buildParams.layout);
+    return desc;
+}
+
+template <typename T>
+static std::unique_ptr<AccelStruct> collapse(const BVH& bvh)
+{
+    return std::make_unique<T>(bvh);
+}
+
+// single threaded primary rays, one per pixel, returns the number of hits
+static uint32_t traceScene(const AccelStruct& accel, const Camera& cam, uint32_t width, uint32_t height, BVHStats& stats)
+{
+    uint32_t hitCount = 0;
+    for (uint32_t y = 0; y < height; y++)
+    {
+        for (uint32_t x = 0; x < width; x++)
+        {
+            Ray ray = cam.getRay(x / float(width), y / float(height));
+            accel.intersect(ray, stats);
+            hitCount += ray.hit.isValid();
+        }
+    }
+    return hitCount;
+}
+
+static void benchmarkScene(const Options& options, const char* sceneName, const Scene& scene, TaskSystem* taskSystem, PerfCounters& perfCounters, std::vector<Result>& results)
+{
+    const BVHBuildParams buildParamsList[] =
+    {
+        { BVHBuildMethod_BinnedSAH, 16 },
+        { BVHBuildMethod_LBVH, 0, 30 },
+        { BVHBuildMethod_SBVH, 16 },
+        { .method = BVHBuildMethod_BinnedSAH, .binCount = 16, .layout = BVHNodeLayout_DepthFirst },
+        { .method = BVHBuildMethod_BinnedSAH, .binCount = 16, .layout = BVHNodeLayout_VanEmdeBoas },
+        { .method = BVHBuildMethod_BinnedSAH, .binCount = 16, .layout = BVHNodeLayout_Treelets },
+    };
+
+    // the spatial split build is serial, larger scenes would dominate the run
+    const size_t kMaxSBVHTriCount = 256 * 1024;
+
+    enum AccelType
+    {
+        AccelType_BVH2, AccelType_BVH4, AccelType_BVH8,
+        AccelType_BVH2Q8, AccelType_BVH4Q8, AccelType_BVH8Q8,
+        AccelType_BVH2Q16, AccelType_BVH4Q16, AccelType_BVH8Q16,
+        AccelType_Count
+    };
+
+    // all but the binary BVH are collapsed from it, one at a time so only one copy is alive
+    std::unique_ptr<AccelStruct> (*const collapseFns[AccelType_Count])(const BVH&) =
+    {
+        nullptr, collapse<BVH4>, collapse<BVH8>,
+        collapse<BVH2Q8>, collapse<BVH4Q8>, collapse<BVH8Q8>,
+        collapse<BVH2Q16>, collapse<BVH4Q16>, collapse<BVH8Q16>,
+    };
+
+    const uint32_t rayCount = options.width * options.height;
+
+    for (const BVHBuildParams& buildParams : buildParamsList)
+    {
+        if (buildParams.method == BVHBuildMethod_SBVH && scene.tris.size() > kMaxSBVHTriCount)
+            continue;
+
+        // the other trees are collapsed into their own order, the layout only moves the binary nodes
+        const uint32_t accelTypeCount = buildParams.layout == BVHNodeLayout_Build ? AccelType_Count : AccelType_BVH4;
+
+        std::vector<double> buildMs[AccelType_Count];
+        std::vector<double> traceMs[AccelType_Count];
+        std::vector<double> mrays[AccelType_Count];
+        std::vector<double> perRay[AccelType_Count][PerfCounter_Count];
+        Result accelResults[AccelType_Count];
+
+        for (uint32_t run = 0; run < options.repeatCount; run++)
+        {
+            Timer buildTimer;
+            BVH bvh(scene.tris.data(), uint32_t(scene.tris.size()), buildParams, taskSystem);
+            double binaryBuildMs = buildTimer.elapsedMs();
+
+            for (uint32_t type = 0; type < accelTypeCount; type++)
+            {
+                std::unique_ptr<AccelStruct> collapsed;
+                const AccelStruct* accel = &bvh;
+                double accelBuildMs = binaryBuildMs;
+                if (collapseFns[type])
+                {
+                    Timer collapseTimer;
+                    collapsed = collapseFns[type](bvh);
+                    accelBuildMs += collapseTimer.elapsedMs();
+                    accel = collapsed.get();
+                }
+
+                BVHStats stats;
+                PerfCounterValues counters;
+                Timer traceTimer;
+                uint32_t hitCount;
+                {
+                    PerfScope perfScope(perfCounters, counters);
+                    hitCount = traceScene(*accel, scene.cam, options.width, options.height, stats);
+                }
+                double ms = traceTimer.elapsedMs();
+
+                for (uint32_t i = 0; i < PerfCounter_Count; i++)
+                {
+                    if (counters.isValid(PerfCounter(i)))
+                        perRay[type][i].push_back(double(counters[PerfCounter(i)]) / rayCount);
+                }
+                accelResults[type].perfCounterMask = counters.validMask;
+
+                buildMs[type].push_back(accelBuildMs);
+                traceMs[type].push_back(ms);
+                mrays[type].push_back(rayCount / (ms * 1e3));
+
+                accelResults[type].accel = accel->getName();
+                accelResults[type].nodeCount = accel->getNodeCount();
+                accelResults[type].nodeBytes = accel->getNodeMemorySize();
+                accelResults[type].hitCount = hitCount;
+            }
+        }
+
+        for (uint32_t type = 0; type < accelTypeCount; type++)
+        {
+            Result& result = accelResults[type];
+            result.scene = sceneName;
+            result.triCount = uint32_t(scene.tris.size());
+            result.build = describeBuild(buildParams);
+            result.buildMs = summarize(buildMs[type]);
+            result.traceMs = summarize(traceMs[type]);
+            result.mrays = summarize(mrays[type]);
+            for (uint32_t i = 0; i < PerfCounter_Count; i++)
+                result.perRay[i] = summarize(perRay[type][i]);
+
+            std::cout << "  " << std::left << std::setw(36) << result.build << std::setw(8) << result.accel << std::right << std::fixed << std::setprecision(2)
+                << " " << std::setw(6) << double(result.nodeBytes) / result.triCount << " B/tri"
+                << " build " << std::setw(10) << result.buildMs.median << " ms (min " << result.buildMs.min << ", sd " << result.buildMs.stddev << ")"
+                << "  trace " << std::setw(9) << result.traceMs.median << " ms (min " << result.traceMs.min << ", sd " << result.traceMs.stddev << ")"
+                << "  " << std::setprecision(3) << result.mrays.median << " Mrays/s\n";
+            std::cout.unsetf(std::ios::floatfield);
+            std::cout << std::setprecision(6);
+
+            if (result.perfCounterMask)
+            {
+                std::cout << "    per ray:";
+                for (uint32_t i = 0; i < PerfCounter_Count; i++)
+                {
+                    if (result.perfCounterMask & (1u << i))
+                        std::cout << " " << toString(PerfCounter(i)) << " " << result.perRay[i].median;
+                }
+                std::cout << "\n";
+            }
+
+            results.push_back(result);
+        }
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Output
+///////////////////////////////////////////////////////////////////////////////
+
+static void writeJsonString(std::ostream& out, const std::string& s)
+{
+    out << '"';
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+            out << '\\';
+        out << c;
+    }
+    out << '"';
+}
+
+static void writeJsonSummary(std::ostream& out, const char* name, const Summary& summary)
+{
+    out << "\"" << name << "\": { \"median\": " << summary.median << ", \"min\": " << summary.min << ", \"stddev\": " << summary.stddev << " }";
+}
+
+static bool writeJson(const char* filepath, const Options& options, const std::vector<Result>& results)
+{
+    std::ofstream out(filepath);
+    if (!out)
+        return false;
+
+    out << std::setprecision(9);
+    out << "{\n";
+    out << "  \"label\": ";
+    writeJsonString(out, options.label);
+    out << ",\n";
+    out << "  \"repeatCount\": " << options.repeatCount << ",\n";
+    out << "  \"width\": " << options.width << ",\n";
+    out << "  \"height\": " << options.height << ",\n";
+    out << "  \"buildThreadCount\": " << options.threadCount << ",\n";
+    out << "  \"profiler\": " << (kProfilerEnabled ? "true" : "false") << ",\n";
+    out << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const Result& result = results[i];
+        out << "    { \"scene\": ";
+        writeJsonString(out, result.scene);
+        out << ", \"triangles\": " << result.triCount << ", \"build\": ";
+        writeJsonString(out, result.build);
+        out << ", \"accel\": ";
+        writeJsonString(out, result.accel);
+        out << ", \"nodes\": " << result.nodeCount << ", \"nodeBytes\": " << result.nodeBytes << ", \"hits\": " << result.hitCount << ",\n      ";
+        writeJsonSummary(out, "buildMs", result.buildMs);
+        out << ", ";
+        writeJsonSummary(out, "traceMs", result.traceMs);
+        out << ", ";
+        writeJsonSummary(out, "mrays", result.mrays);
+        if (result.perfCounterMask)
+        {
+            out << ",\n      \"perRay\": { ";
+            const char* separator = "";
+            for (uint32_t c = 0; c < PerfCounter_Count; c++)
+            {
+                if (!(result.perfCounterMask & (1u << c)))
+                    continue;
+                out << separator;
+                writeJsonSummary(out, kPerfCounterKeys[c], result.perRay[c]);
+                separator = ", ";
+            }
+            out << " }";
+        }
+        out << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n";
+    out << "}\n";
+    return bool(out);
+}
+
+static bool writeCsv(const char* filepath, const Options& options, const std::vector<Result>& results)
+{
+    std::ofstream out(filepath);
+    if (!out)
+        return false;
+
+    // names may contain spaces but no commas or quotes
+    out << std::setprecision(9);
+    out << "label,profiler,scene,triangles,build,accel,nodes,node_bytes,hits,"
+           "build_ms_median,build_ms_min,build_ms_stddev,"
+           "trace_ms_median,trace_ms_min,trace_ms_stddev,"
+           "mrays_median,mrays_min,mrays_stddev";
+    for (const char* key : kPerfCounterKeys)
+        out << "," << key << "_per_ray";
+    out << "\n";
+    for (const Result& result : results)
+    {
+        out << options.label << "," << (kProfilerEnabled ? 1 : 0) << "," << result.scene << "," << result.triCount << "," << result.build << "," << result.accel << ","
+            << result.nodeCount << "," << result.nodeBytes << "," << result.hitCount << ","
+            << result.buildMs.median << "," << result.buildMs.min << "," << result.buildMs.stddev << ","
+            << result.traceMs.median << "," << result.traceMs.min << "," << result.traceMs.stddev << ","
+            << result.mrays.median << "," << result.mrays.min << "," << result.mrays.stddev;
+
+        // medians, empty where the counter isn't available
+        for (uint32_t i = 0; i < PerfCounter_Count; i++)
+        {
+            out << ",";
+            if (result.perfCounterMask & (1u << i))
+                out << result.perRay[i].median;
+        }
+        out << "\n";
+    }
+    return bool(out);
+}
+
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+        return 1;
+
+    std::unique_ptr<TaskSystem> taskSystem;
+    if (options.threadCount > 0)
+        taskSystem = std::make_unique<TaskSystem>(options.threadCount);
+
+    std::cout << options.repeatCount << " runs, " << options.width << "x" << options.height << " primary rays, "
+        << (taskSystem ? std::to_string(taskSystem->getThreadCount()) + " build threads" : "serial build")
+        << ", profiler " << (kProfilerEnabled ? "on" : "off") << "\n";
+
+    // traces run on the main thread
+    PerfCounters perfCounters;
+
+    std::vector<Result> results;
+    for (const SceneDesc& desc : kScenes)
+    {
+        if (!isSceneSelected(options, desc.name))
+            continue;
+
+        // scenes are generated one at a time, the large ones take a few hundred MB
+        Scene scene;
+        if (!desc.init(options, scene))
+            return 1;
+        if (!scene.generatedTris.empty())
+            scene.tris = scene.generatedTris;
+
+        std::cout << "\n" << desc.name << ", " << scene.tris.size() << " triangles:\n";
+        benchmarkScene(options, desc.name, scene, taskSystem.get(), perfCounters, results);
+    }
+
+    if (!options.jsonFilepath.empty() && !writeJson(options.jsonFilepath.c_str(), options, results))
+    {
+        std::cerr << "failed to write " << options.jsonFilepath << "\n";
+        return 1;
+    }
+    if (!options.csvFilepath.empty() && !writeCsv(options.csvFilepath.c_str(), options, results))
+    {
+        std::cerr << "failed to write " << options.csvFilepath << "\n";
+        return 1;
+    }
+
+    return 0;
+}
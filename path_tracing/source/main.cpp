@@ -1,54 +1,113 @@
+#include "Core/PerfCounters.h"
+#include "Core/Profiler.h"
+#include "Core/TaskSystem.h"
+#include "Image/AccumulationBuffer.h"
 #include "Image/Image.h"
+#include "Render/Camera.h"
+#include "Render/Renderer.h"
+#include "Scene/SceneFile.h"
+#include "Scene/SceneGenerator.h"
 #include "BVH.h"
+#include "QuantizedBVH.h"
+#include "TLAS.h"
 #include "Util.h"
+#include "WideBVH.h"
 
 #include "Math/Intersect.h"
 using namespace Math;
 
 #include <cstdio>
 #include <iostream>
+#include <span>
 
 #define USE_BVH
 
 //#define SCENE_USE_RANDOMIZED_TRIANGLE
 #define SCENE_USE_UNITY_ROBOLAB
 
-std::vector<Tri> tris;
+// scene triangles, either generated or mapped from a scene file
+std::vector<Tri> randomTris;
+SceneFile sceneFile;
+std::span<const Tri> tris;
 
-static void initScene()
+// the default BVH of the scene is saved here and reused while the scene doesn't change
+const char* bvhCacheFilepath = nullptr;
+
+static bool initScene()
 {
+    PROFILE_ZONE("scene load");
+
 #ifdef SCENE_USE_RANDOMIZED_TRIANGLE
-    tris.resize(1024);
-    for (Tri& tri : tris)
-    {
-        float3 r0( RandomFloat(), RandomFloat(), RandomFloat() );
-        float3 r1( RandomFloat(), RandomFloat(), RandomFloat() );
-        float3 r2( RandomFloat(), RandomFloat(), RandomFloat() );
-        tri.vertex0 = r0 * 9.0f - float3( 5.0f );
-        tri.vertex1 = tri.vertex0 + r1;
-        tri.vertex2 = tri.vertex0 + r2;
-    }
+    generateRandomTris(randomTris, 1024);
+    tris = randomTris;
 #endif
 
 #ifdef SCENE_USE_UNITY_ROBOLAB
-    tris.resize(12582);
-    FILE* file = fopen("../../assets/unity.tri", "r");
-    float a, b, c, d, e, f, g, h, i;
-    for (Tri& tri : tris)
+    const char* textFilepath = "../../assets/unity.tri";
+    const char* filepath = "../../assets/unity.trib";
+
+    // the binary file is generated from the text file on first use
+    Timer loadTimer;
+    if (!sceneFile.load(filepath))
     {
-        fscanf(file, "%f %f %f %f %f %f %f %f %f\n", &a, &b, &c, &d, &e, &f, &g, &h, &i);
-        tri.vertex0 = float3( a, b, c );
-        tri.vertex1 = float3( d, e, f );
-        tri.vertex2 = float3( g, h, i );
+        if (!SceneFile::convertText(textFilepath, filepath) || !sceneFile.load(filepath))
+        {
+            std::cerr << "failed to load scene " << textFilepath << "\n";
+            return false;
+        }
+        std::cout << "converted " << textFilepath << " to " << filepath << "\n";
     }
-    fclose(file);
+    std::cout << "scene load: " << loadTimer.elapsedMs() << " ms, " << sceneFile.getTriCount() << " triangles.\n";
+
+    tris = std::span<const Tri>(sceneFile.getTris(), sceneFile.getTriCount());
+    bvhCacheFilepath = "../../assets/unity.bvh";
 #endif
 
-    // compute centroid
-    for (Tri& tri : tris)
+    return true;
+}
+
+static BVH loadOrBuildBVH()
+{
+    Timer timer;
+    if (bvhCacheFilepath)
     {
-        tri.centroid = (tri.vertex0 + tri.vertex1 + tri.vertex2) / 3.0f;
+        if (std::optional<BVH> bvh = BVH::load(bvhCacheFilepath, tris.data(), uint32_t(tris.size())))
+        {
+            std::cout << "bvh loaded from " << bvhCacheFilepath << ": " << timer.elapsedMs() << " ms.\n";
+            return std::move(*bvh);
+        }
     }
+
+    BVH bvh(tris.data(), uint32_t(tris.size()));
+    std::cout << "bvh construction: " << timer.elapsedMs() << " ms.\n";
+
+    if (bvhCacheFilepath && !bvh.save(bvhCacheFilepath))
+        std::cerr << "failed to save " << bvhCacheFilepath << "\n";
+
+    return bvh;
+}
+
+// items and everything the BVH allocated for them
+static size_t getMemorySize(const BVH& bvh)
+{
+    return bvh.getItemCount() * sizeof(BVH::Item)
+        + bvh.getNodeMemorySize()
+        + bvh.getItemRefs().size() * sizeof(uint32_t)
+        + bvh.getTriBlocks().size() * sizeof(TriBlock4)
+        + bvh.getTriVertexBlocks().size() * sizeof(TriVertexBlock4);
+}
+
+static void printBuildParams(const BVHBuildParams& buildParams)
+{
+    std::cout << toString(buildParams.method);
+    if (buildParams.method == BVHBuildMethod_BinnedSAH)
+        std::cout << " (" << buildParams.binCount << " bins)";
+    if (buildParams.method == BVHBuildMethod_LBVH)
+        std::cout << " (" << buildParams.mortonBits << "-bit Morton codes)";
+    if (buildParams.method == BVHBuildMethod_SBVH)
+        std::cout << " (" << buildParams.binCount << " bins, overlap threshold " << buildParams.splitOverlapThreshold << ")";
+    if (buildParams.layout != BVHNodeLayout_Build)
+        std::cout << ", " << toString(buildParams.layout) << " layout";
 }
 
 void printRayPerSecond(uint32_t rayCount, int64_t durationMs)
@@ -82,76 +141,694 @@ inline void printBVHStats(const BVHStats& stats)
 #endif
 }
 
-int main()
-{    
-    initScene();
-
-    // construct BVH
-    Timer buildBvhTimer;
+// per ray / triangle figures stay comparable across images sizes and scenes
+static void printPerfCounters(const char* region, const PerfCounterValues& values, uint64_t itemCount = 0, const char* itemName = "ray")
+{
+    if (!values.validMask)
+        return;
 
-    BVH bvh(tris.data(), uint32_t(tris.size()));
+    std::cout << "perf counters, " << region << ":\n";
+    for (uint32_t i = 0; i < PerfCounter_Count; i++)
+    {
+        PerfCounter counter = PerfCounter(i);
+        if (!values.isValid(counter))
+            continue;
 
-    std::cout << "bvh construction: " << buildBvhTimer.duration() << " ms.\n";
+        std::cout << "  " << toString(counter) << ": " << values[counter];
+        if (itemCount)
+            std::cout << ", " << double(values[counter]) / double(itemCount) << " per " << itemName;
+        std::cout << "\n";
+    }
 
-    Image img(640, 640);
-    img.clear(colors::black());
+    if (values.isValid(PerfCounter_Cycles) && values.isValid(PerfCounter_Instructions) && values[PerfCounter_Cycles])
+        std::cout << "  IPC: " << double(values[PerfCounter_Instructions]) / double(values[PerfCounter_Cycles]) << "\n";
+}
 
+static Camera initCamera()
+{
 #ifdef SCENE_USE_RANDOMIZED_TRIANGLE
-    float3 camPos( 0, 0, -18 );
-    float3 p0( -1, 1, -15 );
-    float3 p1( 1, 1, -15 );
-    float3 p2( -1, -1, -15 );
+    return Camera{ float3( 0, 0, -18 ), float3( -1, 1, -15 ), float3( 1, 1, -15 ), float3( -1, -1, -15 ) };
 #endif
 #ifdef SCENE_USE_UNITY_ROBOLAB
-    float3 camPos( -1.5f, -0.2f, -2.5f );
-    float3 p0( -2.5f, 0.8f, -0.5f );
-    float3 p1( -0.5f, 0.8f, -0.5f );
-    float3 p2( -2.5f, -1.2f, -0.5f );
+    return Camera{ float3( -1.5f, -0.2f, -2.5f ), float3( -2.5f, 0.8f, -0.5f ), float3( -0.5f, 0.8f, -0.5f ), float3( -2.5f, -1.2f, -0.5f ) };
 #endif
+}
+
+// returns tracing duration in ms
+static int64_t traceScene(AccelStruct& accel, const Camera& cam, Image& img)
+{
+    PROFILE_ZONE("trace");
+    Timer timer;
 
-    // Ray tracing
+    for (uint32_t y = 0; y < img.height; y++)
     {
-        Timer timer;
+        for (uint32_t x = 0; x < img.width; x++)
+        {
+            Ray ray = cam.getRay(x / float(img.width), y / float(img.height));
+
+        #ifdef USE_BVH
+            accel.intersect(ray);
+        #else
+            for (uint32_t i = 0; i < tris.size(); i++)
+                intersectRayTri(ray, tris[i], i);
+        #endif
+
+            if (ray.hit.t < Ray::kInf)
+            {
+                // depth as color
+                uint8_t d = uint8_t(saturate(1.0f - ray.hit.t / 4.0f) * 255.0f);
+                img(x, y) = color3b(d);
+
+                //img(x, y) = colors::white();
+            }
+        }
+    }
+
+    return timer.duration();
+}
+
+// Packets cover tiles of kTileWidth x kTileHeight pixels.
+// returns tracing duration in ms
+template <uint32_t N>
+static int64_t traceScenePackets(BVH& bvh, const Camera& cam, Image& img)
+{
+    constexpr uint32_t kTileWidth = 4;
+    constexpr uint32_t kTileHeight = N / kTileWidth;
+    static_assert(kTileWidth * kTileHeight == N);
+
+    Timer timer;
+
+    RayPacket<N> packet;
+    for (uint32_t tileY = 0; tileY < img.height; tileY += kTileHeight)
+    {
+        for (uint32_t tileX = 0; tileX < img.width; tileX += kTileWidth)
+        {
+            // lanes outside of the image stay inactive
+            uint32_t activeMask = 0;
+            for (uint32_t lane = 0; lane < N; lane++)
+            {
+                uint32_t x = tileX + lane % kTileWidth;
+                uint32_t y = tileY + lane / kTileWidth;
+                if (x >= img.width || y >= img.height)
+                    continue;
+
+                packet.setRay(lane, cam.getRay(x / float(img.width), y / float(img.height)));
+                activeMask |= 1u << lane;
+            }
+
+            bvh.intersect(packet, activeMask);
+
+            for (uint32_t lane = 0; lane < N; lane++)
+            {
+                if (!(activeMask & (1u << lane)) || packet.t[lane] >= Ray::kInf)
+                    continue;
+
+                // depth as color
+                uint8_t d = uint8_t(saturate(1.0f - packet.t[lane] / 4.0f) * 255.0f);
+                img(tileX + lane % kTileWidth, tileY + lane / kTileWidth) = color3b(d);
+            }
+        }
+    }
+
+    return timer.duration();
+}
+
+int main()
+{    
+    if (!initScene())
+        return 1;
+
+    Camera cam = initCamera();
+    Image img(640, 640);
+
+    // of the main thread, around single threaded regions
+    PerfCounters perfCounters;
+    std::cout << "perf counters:";
+    for (uint32_t i = 0; i < PerfCounter_Count; i++)
+        std::cout << " " << toString(PerfCounter(i)) << (perfCounters.isAvailable(PerfCounter(i)) ? "" : " (unavailable)") << (i + 1 < PerfCounter_Count ? "," : "\n");
+
+    // compare build time and trace quality of each build method on the same scene
+    BVHBuildParams buildParamsList[] =
+    {
+        { BVHBuildMethod_SweepSAH },
+        { BVHBuildMethod_BinnedSAH, 8 },
+        { BVHBuildMethod_BinnedSAH, 16 },
+        { BVHBuildMethod_BinnedSAH, 32 },
+        { BVHBuildMethod_LBVH, 0, 30 },
+        { BVHBuildMethod_LBVH, 0, 63 },
+        { BVHBuildMethod_SBVH, 16 },
+    };
+
+    for (const BVHBuildParams& buildParams : buildParamsList)
+    {
+        std::cout << "\n";
+        printBuildParams(buildParams);
+        std::cout << ":\n";
+
+        // construct BVH
+        PerfCounterValues buildCounters;
+        Timer buildBvhTimer;
+
+        std::optional<BVH> bvh;
+        {
+            PerfScope perfScope(perfCounters, buildCounters);
+            bvh.emplace(tris.data(), uint32_t(tris.size()), buildParams);
+        }
+
+        std::cout << "bvh construction: " << buildBvhTimer.elapsedMs() << " ms.\n";
+        std::cout << "bvh node count: " << bvh->getNodeCount() << "\n";
+        std::cout << "bvh item refs: " << bvh->getItemRefs().size() << " for " << tris.size() << " triangles\n";
+
+        // Ray tracing
+        img.clear(colors::black());
+
+        PerfCounterValues traceCounters;
+        int64_t durationMs;
+        {
+            PerfScope perfScope(perfCounters, traceCounters);
+            durationMs = traceScene(*bvh, cam, img);
+        }
+        std::cout << "raytracing: " << durationMs << " ms.\n";
+
+        printRayPerSecond(img.width * img.height, durationMs);
+
+    #ifdef BVH_ENABLE_PROFILING
+        printBVHStats(bvh->getStats());
+    #endif
+        printPerfCounters("construction", buildCounters, tris.size(), "triangle");
+        printPerfCounters("raytracing", traceCounters, img.width * img.height);
+    }
+
+    // binary and wide BVHs over the same items, with float and quantized child bounds
+    {
+        std::cout << "\n";
+
+        BVH bvh = loadOrBuildBVH();
+        BVH4 bvh4(bvh);
+        BVH8 bvh8(bvh);
+        BVH2Q8 bvh2q8(bvh);
+        BVH4Q8 bvh4q8(bvh);
+        BVH8Q8 bvh8q8(bvh);
+        BVH2Q16 bvh2q16(bvh);
+        BVH4Q16 bvh4q16(bvh);
+        BVH8Q16 bvh8q16(bvh);
+
+        AccelStruct* accels[] = { &bvh, &bvh4, &bvh8, &bvh2q8, &bvh4q8, &bvh8q8, &bvh2q16, &bvh4q16, &bvh8q16 };
+        for (AccelStruct* accel : accels)
+        {
+            std::cout << accel->getName() << ":\n";
+            std::cout << "node count: " << accel->getNodeCount() << ", " << accel->getNodeMemorySize() / 1024 << " KB, "
+                << double(accel->getNodeMemorySize()) / tris.size() << " bytes/triangle\n";
 
-        Ray ray;
+            img.clear(colors::black());
+
+            PerfCounterValues traceCounters;
+            int64_t durationMs;
+            {
+                PerfScope perfScope(perfCounters, traceCounters);
+                durationMs = traceScene(*accel, cam, img);
+            }
+            std::cout << "raytracing: " << durationMs << " ms.\n";
+
+            printRayPerSecond(img.width * img.height, durationMs);
+
+        #ifdef BVH_ENABLE_PROFILING
+            printBVHStats(accel->getStats());
+        #endif
+            printPerfCounters("raytracing", traceCounters, img.width * img.height);
+        }
+    }
+
+    // single rays vs ray packets for primary visibility
+    {
+        std::cout << "\nPacket traversal:\n";
+
+        BVH bvh = loadOrBuildBVH();
+
+        struct PacketTest
+        {
+            const char* name;
+            int64_t (*trace)(BVH& bvh, const Camera& cam, Image& img);
+        };
+        PacketTest packetTests[] =
+        {
+            { "single rays", [](BVH& bvh, const Camera& cam, Image& img) { return traceScene(bvh, cam, img); } },
+            { "4 ray packets", traceScenePackets<4> },
+            { "8 ray packets", traceScenePackets<8> },
+            { "16 ray packets", traceScenePackets<16> },
+        };
+
+        for (const PacketTest& packetTest : packetTests)
+        {
+            img.clear(colors::black());
+
+            int64_t durationMs = packetTest.trace(bvh, cam, img);
+            std::cout << "  " << packetTest.name << ": " << durationMs << " ms, ";
+            printRayPerSecond(img.width * img.height, durationMs);
+        }
+    }
+
+    // closest hit vs any hit queries for shadow rays
+    {
+        std::cout << "\nShadow rays:\n";
+
+        BVH bvh = loadOrBuildBVH();
+        BVH4 bvh4(bvh);
+        BVH8 bvh8(bvh);
+
+        // from the primary hits to a point light, slightly shortened at both ends to not hit their own surfaces
+        const float3 lightPos( -1.0f, 1.0f, -1.5f );
+        const float kShadowBias = 1e-3f;
+
+        std::vector<Ray> shadowRays;
         for (uint32_t y = 0; y < img.height; y++)
         {
             for (uint32_t x = 0; x < img.width; x++)
             {
-                float3 pixelPos = p0 + (p1 - p0) * (x / float(img.width)) + (p2 - p0) * (y / float(img.height));
-                ray.O = camPos;
-                ray.D = normalize( pixelPos - ray.O );
-                ray.t = Ray::kInf;
-
-            #ifdef USE_BVH
+                Ray ray = cam.getRay(x / float(img.width), y / float(img.height));
                 bvh.intersect(ray);
-            #else
-                for (const Tri& tri : tris)
-                    intersectRayTri(ray, tri);
-            #endif
+                if (!ray.hit.isValid())
+                    continue;
+
+                float3 hitPos = interpolatePosition(tris[ray.hit.primId], ray.hit.u, ray.hit.v);
+                float dist = length(lightPos - hitPos);
+                float3 dir = (lightPos - hitPos) / dist;
+                shadowRays.push_back(Ray(hitPos + dir * kShadowBias, dir, dist - 2.0f * kShadowBias));
+            }
+        }
+
+        AccelStruct* accels[] = { &bvh, &bvh4, &bvh8 };
+        for (AccelStruct* accel : accels)
+        {
+            Timer intersectTimer;
+            uint32_t intersectCount = 0;
+            for (Ray ray : shadowRays)
+            {
+                float maxT = ray.hit.t;
+                accel->intersect(ray);
+                intersectCount += ray.hit.t < maxT;
+            }
+            int64_t intersectMs = intersectTimer.duration();
+
+            Timer occludedTimer;
+            uint32_t occludedCount = 0;
+            for (const Ray& ray : shadowRays)
+                occludedCount += accel->occluded(ray);
+            int64_t occludedMs = occludedTimer.duration();
 
-                if (ray.t < Ray::kInf)
+            std::cout << "  " << accel->getName() << " intersect: " << intersectMs << " ms, " << intersectCount << "/" << shadowRays.size() << " in shadow, ";
+            printRayPerSecond(uint32_t(shadowRays.size()), intersectMs);
+            std::cout << "  " << accel->getName() << " occluded: " << occludedMs << " ms, " << occludedCount << "/" << shadowRays.size() << " in shadow, ";
+            printRayPerSecond(uint32_t(shadowRays.size()), occludedMs);
+        }
+    }
+
+    // Edge leaks: rays from inside a closed sphere aimed at its vertices and
+    // edge midpoints must all hit, every miss went through a crack
+    {
+        std::cout << "\nWatertight intersection:\n";
+
+        struct SphereTest
+        {
+            const char* name;
+            float radius;
+            uint32_t rings;
+        };
+        SphereTest sphereTests[] =
+        {
+            { "sphere", 1.0f, 64 },
+            { "finely tessellated sphere", 1.0f, 512 },
+            { "small sphere", 0.01f, 64 },
+        };
+
+        for (const SphereTest& sphereTest : sphereTests)
+        {
+            std::vector<Tri> sphereTris;
+            generateSphereTris(sphereTris, sphereTest.radius, sphereTest.rings, sphereTest.rings * 2);
+
+            const float3 origin = float3( 0.1f, 0.2f, -0.05f ) * sphereTest.radius;
+            std::vector<float3> targets;
+            for (const Tri& tri : sphereTris)
+            {
+                targets.push_back(tri.vertex0);
+                targets.push_back((tri.vertex0 + tri.vertex1) * 0.5f);
+                targets.push_back((tri.vertex1 + tri.vertex2) * 0.5f);
+                targets.push_back((tri.vertex2 + tri.vertex0) * 0.5f);
+            }
+
+            std::cout << "  " << sphereTest.name << ", " << sphereTris.size() << " triangles, " << targets.size() << " rays:\n";
+            for (uint32_t kernel = 0; kernel < BVHTriKernel_Count; kernel++)
+            {
+                BVHBuildParams buildParams;
+                buildParams.triKernel = BVHTriKernel(kernel);
+                BVH bvh(sphereTris.data(), uint32_t(sphereTris.size()), buildParams);
+
+                uint32_t leakCount = 0;
+                for (const float3& target : targets)
                 {
-                    // depth as color
-                    uint8_t d = uint8_t(saturate(1.0f - ray.t / 4.0f) * 255.0f);
-                    img(x, y) = color3b(d);
+                    Ray ray(origin, normalize(target - origin));
+                    bvh.intersect(ray);
+                    leakCount += !ray.hit.isValid();
+                }
+                std::cout << "    " << toString(BVHTriKernel(kernel)) << ": " << leakCount << " leaks\n";
+            }
+        }
+
+        // cost of the watertight test on the scene
+        for (uint32_t kernel = 0; kernel < BVHTriKernel_Count; kernel++)
+        {
+            BVHBuildParams buildParams;
+            buildParams.triKernel = BVHTriKernel(kernel);
+            std::optional<BVH> bvh;
+            if (bvhCacheFilepath)
+                bvh = BVH::load(bvhCacheFilepath, tris.data(), uint32_t(tris.size()), buildParams);
+            if (!bvh)
+                bvh.emplace(tris.data(), uint32_t(tris.size()), buildParams);
+
+            int64_t durationMs = traceScene(*bvh, cam, img);
+            std::cout << "  " << toString(BVHTriKernel(kernel)) << " raytracing: " << durationMs << " ms, ";
+            printRayPerSecond(img.width * img.height, durationMs);
+        }
+    }
+
+    // multithreaded tile renderer
+    {
+        std::cout << "\nTile renderer:\n";
+
+        BVH bvh = loadOrBuildBVH();
+        TaskSystem taskSystem;
+
+        for (uint32_t tileSize : { 16, 32 })
+        {
+            Renderer renderer(taskSystem, tileSize);
+
+            Timer timer;
+            BVHStats stats = renderer.renderDepth(bvh, cam, img);
+            int64_t durationMs = timer.duration();
+
+            std::cout << "  " << taskSystem.getThreadCount() << " threads, " << tileSize << "x" << tileSize << " tiles: " << durationMs << " ms, ";
+            printRayPerSecond(img.width * img.height, durationMs);
+
+        #ifdef BVH_ENABLE_PROFILING
+            printBVHStats(stats);
+        #endif
+        }
+    }
+
+    // instancing: copies of the scene placed by a TLAS, against the same copies flattened into one BVH
+    {
+        std::cout << "\nInstancing:\n";
+
+        const uint32_t kGridSize = 8;
+
+        BVH blas = loadOrBuildBVH();
+        Aabb blasBounds = blas.getBounds();
+        float3 blasCenter = (blasBounds.min + blasBounds.max) * 0.5f;
+        float3 blasExtent = blasBounds.extent();
+        float spacing = std::max(blasExtent.x, blasExtent.z) * 1.5f;
+
+        // rotated about their center so they don't overlap their neighbours
+        TLAS::Instances instances;
+        for (uint32_t z = 0; z < kGridSize; z++)
+        {
+            for (uint32_t x = 0; x < kGridSize; x++)
+            {
+                float3x4 transform = float3x4::translation(float3( x * spacing, 0.0f, z * spacing ))
+                    * float3x4::rotationY(float(z * kGridSize + x) * 0.7f)
+                    * float3x4::translation(-blasCenter);
+                instances.emplace_back(blas, transform);
+            }
+        }
+
+        std::vector<Tri> flatTris;
+        flatTris.reserve(instances.size() * tris.size());
+        for (const BVHInstance& instance : instances)
+        {
+            for (const Tri& tri : tris)
+            {
+                Tri& flatTri = flatTris.emplace_back();
+                flatTri.vertex0 = instance.transform.transformPoint(tri.vertex0);
+                flatTri.vertex1 = instance.transform.transformPoint(tri.vertex1);
+                flatTri.vertex2 = instance.transform.transformPoint(tri.vertex2);
+            }
+        }
+        computeCentroids(flatTris);
+
+        Timer flatBuildTimer;
+        BVH flatBvh(flatTris.data(), uint32_t(flatTris.size()));
+        double flatBuildMs = flatBuildTimer.elapsedMs();
+
+        Timer tlasBuildTimer;
+        TLAS tlas(std::move(instances));
+        double tlasBuildMs = tlasBuildTimer.elapsedMs();
+
+        std::cout << "  " << tlas.getInstanceCount() << " instances of " << tris.size() << " triangles\n";
+        std::cout << "  flattened: " << flatTris.size() << " triangles, build " << flatBuildMs << " ms, " << getMemorySize(flatBvh) / 1024 << " KB\n";
+        std::cout << "  instanced: " << tlas.getNodeCount() << " TLAS nodes, build " << tlasBuildMs << " ms, " << (getMemorySize(blas) + tlas.getNodeMemorySize()) / 1024 << " KB\n";
+
+        float gridSize = kGridSize * spacing;
+        float3 gridCenter = float3( 0.5f * (gridSize - spacing), 0.0f, 0.5f * (gridSize - spacing) );
+        Camera gridCam = Camera::lookAt(gridCenter + float3( -0.4f, 0.3f, -0.4f ) * gridSize, gridCenter, 0.6f);
+
+        AccelStruct* accels[] = { &flatBvh, &tlas };
+        for (AccelStruct* accel : accels)
+        {
+            img.clear(colors::black());
+            int64_t durationMs = traceScene(*accel, gridCam, img);
+            std::cout << "  " << accel->getName() << " raytracing: " << durationMs << " ms, ";
+            printRayPerSecond(img.width * img.height, durationMs);
+        }
+
+        // moving an instance only rebuilds the top level
+        tlas.setTransform(0, float3x4::translation(float3( 0.0f, blasExtent.y, 0.0f )) * tlas.getInstance(0).transform);
+        Timer rebuildTimer;
+        tlas.rebuild();
+        std::cout << "  TLAS rebuild after moving an instance: " << rebuildTimer.elapsedMs() << " ms\n";
+    }
+
+    // deforming mesh: the tree built for the rest pose is refitted every frame,
+    // a fresh build of the same frame shows how far the refitted tree degraded
+    {
+        std::cout << "\nRefit:\n";
+
+        std::vector<Tri> restTris;
+        generateTerrainTris(restTris, 256, 10.0f, 1.0f);
+        std::vector<Tri> deformedTris = restTris;
+
+        TaskSystem taskSystem;
+        BVH bvh(deformedTris.data(), uint32_t(deformedTris.size()), BVHBuildParams(), &taskSystem);
+        std::cout << "  " << deformedTris.size() << " triangles, SAH cost " << bvh.computeSAHCost() << "\n";
+
+        for (uint32_t frame = 1; frame <= 4; frame++)
+        {
+            // twist about the y axis, vertices further out turn more
+            float twist = 0.1f * float(frame);
+            auto deform = [twist](const float3& p) { return float3x4::rotationY(twist * length(float3( p.x, 0.0f, p.z ))).transformPoint(p); };
+            for (size_t i = 0; i < restTris.size(); i++)
+            {
+                deformedTris[i].vertex0 = deform(restTris[i].vertex0);
+                deformedTris[i].vertex1 = deform(restTris[i].vertex1);
+                deformedTris[i].vertex2 = deform(restTris[i].vertex2);
+            }
+            computeCentroids(deformedTris);
 
-                    //img(x, y) = colors::white();
+            Timer refitTimer;
+            bvh.refit(&taskSystem);
+            double refitMs = refitTimer.elapsedMs();
+            float refitCost = bvh.computeSAHCost();
+
+            Timer rebuildTimer;
+            BVH rebuiltBvh(deformedTris.data(), uint32_t(deformedTris.size()), BVHBuildParams(), &taskSystem);
+            double rebuildMs = rebuildTimer.elapsedMs();
+            float rebuildCost = rebuiltBvh.computeSAHCost();
+
+            std::cout << "  twist " << twist << ": refit " << refitMs << " ms, SAH cost " << refitCost
+                << ", rebuild " << rebuildMs << " ms, SAH cost " << rebuildCost << ", ratio " << refitCost / rebuildCost << "\n";
+        }
+    }
+
+    // node layouts: the same tree with its nodes reordered, over the scene and over
+    // random triangles whose nodes don't fit in the caches
+    {
+        std::cout << "\nNode layouts:\n";
+
+        std::vector<Tri> randomTris;
+        generateRandomTris(randomTris, 1024 * 1024, 0.1f);
+        const Camera randomCam{ float3( 0, 0, -18 ), float3( -1, 1, -15 ), float3( 1, 1, -15 ), float3( -1, -1, -15 ) };
+
+        struct LayoutScene
+        {
+            const char* name;
+            std::span<const Tri> tris;
+            const Camera& cam;
+        };
+        const LayoutScene layoutScenes[] = { { "scene", tris, cam }, { "random", randomTris, randomCam } };
+
+        for (const LayoutScene& layoutScene : layoutScenes)
+        {
+            BVH bvh(layoutScene.tris.data(), uint32_t(layoutScene.tris.size()));
+            std::cout << "  " << layoutScene.name << ", " << bvh.getNodeCount() << " nodes:\n";
+
+            for (uint32_t layout = 0; layout < BVHNodeLayout_Count; layout++)
+            {
+                Timer relayoutTimer;
+                bvh.relayout(BVHNodeLayout(layout));
+                double relayoutMs = relayoutTimer.elapsedMs();
+
+                PerfCounterValues traceCounters;
+                int64_t durationMs;
+                {
+                    PerfScope perfScope(perfCounters, traceCounters);
+                    durationMs = traceScene(bvh, layoutScene.cam, img);
                 }
+
+                std::cout << "    " << toString(BVHNodeLayout(layout)) << ": relayout " << relayoutMs << " ms, trace " << durationMs << " ms, ";
+                printRayPerSecond(img.width * img.height, durationMs);
+                printPerfCounters(toString(BVHNodeLayout(layout)), traceCounters, img.width * img.height);
             }
         }
+    }
+
+    // path tracing: diffuse bounces, next event estimation, Russian roulette
+    {
+        std::cout << "\nPath tracer:\n";
+
+        BVH bvh = loadOrBuildBVH();
+        TaskSystem taskSystem;
+        Renderer renderer(taskSystem);
 
+        PathTracerParams params;
+        params.samplesPerPixel = 4;
+        PathTracer pathTracer(bvh, tris.data(), params);
+
+        Image pathTracedImg(img.width, img.height);
+
+        Timer timer;
+        PathTracerStats stats = renderer.renderPathTraced(pathTracer, cam, pathTracedImg);
         int64_t durationMs = timer.duration();
-        std::cout << "raytracing: " << durationMs << " ms.\n";
 
-        printRayPerSecond(img.width * img.height, durationMs);
+        std::cout << "  " << params.samplesPerPixel << " spp, max depth " << params.maxDepth << ": " << durationMs << " ms, ";
+        printRayPerSecond(uint32_t(stats.getRayCount()), durationMs);
+        std::cout << "  primary rays: " << stats.primaryRayCount << ", bounce rays: " << stats.bounceRayCount << ", shadow rays: " << stats.shadowRayCount << "\n";
 
     #ifdef BVH_ENABLE_PROFILING
-        printBVHStats(bvh.getStats());
+        printBVHStats(stats.bvh);
     #endif
+
+        pathTracedImg.save("path_traced.png");
+
+        // progressive: 1 spp passes into the float buffer until the time budget runs out,
+        // the image can be resolved after any pass
+        const double budgetMs = 1500.0;
+        AccumulationBuffer accum(img.width, img.height);
+
+        uint32_t passCount = 0;
+        Timer progressiveTimer;
+        while (progressiveTimer.elapsedMs() < budgetMs)
+        {
+            renderer.renderPathTraced(pathTracer, cam, accum, 1);
+            passCount++;
+        }
+        double progressiveMs = progressiveTimer.elapsedMs();
+
+        Timer resolveTimer;
+        renderer.resolve(accum, pathTracedImg);
+        double resolveMs = resolveTimer.elapsedMs();
+
+        std::cout << "  progressive, " << budgetMs << " ms budget: " << passCount << " passes (" << passCount << " spp) in " << progressiveMs << " ms, resolve: " << resolveMs << " ms\n";
+
+        pathTracedImg.save("path_traced_progressive.png");
+
+        // wavefront: stages over streams of paths, bounce rays sorted in between
+        for (bool sortRays : { false, true })
+        {
+            WavefrontParams wavefrontParams;
+            wavefrontParams.sortRays = sortRays;
+            accum.clear();
+
+            Timer wavefrontTimer;
+            PathTracerStats wavefrontStats = renderer.renderPathTracedWavefront(pathTracer, cam, accum, params.samplesPerPixel, wavefrontParams);
+            durationMs = wavefrontTimer.duration();
+
+            std::cout << "  wavefront, " << wavefrontParams.waveSize << " paths per wave, " << (sortRays ? "sorted" : "unsorted") << ": " << durationMs << " ms, ";
+            printRayPerSecond(uint32_t(wavefrontStats.getRayCount()), durationMs);
+        }
+
+        // adaptive: tiles stop sampling once their estimated error is below the threshold
+        AdaptiveSamplingParams adaptiveParams;
+        adaptiveParams.maxSamplesPerPixel = 32;
+        Renderer adaptiveRenderer(taskSystem, 16);
+        accum.clear();
+
+        Timer adaptiveTimer;
+        AdaptiveSamplingResult adaptive = adaptiveRenderer.renderPathTracedAdaptive(pathTracer, cam, accum, adaptiveParams);
+        durationMs = adaptiveTimer.duration();
+
+        std::cout << "  adaptive, threshold " << adaptiveParams.errorThreshold << ", " << adaptiveParams.minSamplesPerPixel << "-" << adaptiveParams.maxSamplesPerPixel << " spp: "
+            << adaptive.passCount << " passes, " << adaptive.convergedTileCount << "/" << adaptive.tileCount << " tiles converged, "
+            << double(accum.getSampleCount()) / (img.width * img.height) << " spp average, " << durationMs << " ms, ";
+        printRayPerSecond(uint32_t(adaptive.stats.getRayCount()), durationMs);
+
+        adaptiveRenderer.resolve(accum, pathTracedImg);
+        pathTracedImg.save("path_traced_adaptive.png");
     }
 
-    img.save("output.png");
+    // build times for a large randomized scene, too large for the sweep and the serial spatial split build
+    {
+        std::vector<Tri> largeTris;
+        generateRandomTris(largeTris, 1024 * 1024, 0.1f);
+
+        std::cout << "\n" << largeTris.size() << " randomized triangles:\n";
+        for (const BVHBuildParams& buildParams : buildParamsList)
+        {
+            if (buildParams.method == BVHBuildMethod_SweepSAH || buildParams.method == BVHBuildMethod_SBVH)
+                continue;
+
+            Timer buildBvhTimer;
+            BVH bvh(largeTris.data(), uint32_t(largeTris.size()), buildParams);
+            double buildMs = buildBvhTimer.elapsedMs();
+
+            std::cout << "  ";
+            printBuildParams(buildParams);
+            std::cout << ": " << buildMs << " ms.\n";
+        }
+
+        // parallel build speed-up vs thread count, small scenes are dominated by the task overhead
+        std::cout << "\nParallel " << toString(BVHBuildParams().method) << " build, " << largeTris.size() << " randomized triangles:\n";
+
+        const uint32_t maxThreadCount = TaskSystem::getHardwareThreadCount();
+        double serialMs = 0.0;
+        for (uint32_t threadCount = 1; ; threadCount = std::min(threadCount * 2, maxThreadCount))
+        {
+            TaskSystem taskSystem(threadCount);
+
+            Timer buildBvhTimer;
+            BVH bvh(largeTris.data(), uint32_t(largeTris.size()), BVHBuildParams(), &taskSystem);
+            double buildMs = buildBvhTimer.elapsedMs();
+
+            if (threadCount == 1)
+                serialMs = buildMs;
+
+            std::cout << "  " << threadCount << " threads: " << buildMs << " ms, speed-up " << serialMs / buildMs << "x\n";
+
+            if (threadCount == maxThreadCount)
+                break;
+        }
+    }
+
+    PerfCounterValues saveCounters;
+    {
+        PROFILE_ZONE("image save");
+        PerfScope perfScope(perfCounters, saveCounters);
+        img.save("output.png");
+    }
+    std::cout << "\n";
+    printPerfCounters("image save", saveCounters);
+
+#ifdef PROFILER_ENABLED
+    if (Profiler::saveChromeTrace("profile.json"))
+        std::cout << "profile: " << Profiler::getEventCount() << " zones saved to profile.json\n";
+#endif
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,186 @@
+#include "Scene/SceneGenerator.h"
+#include "BVH.h"
+#include "TLAS.h"
+using namespace Math;
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+// Regression checks for degenerate inputs, run by ctest. Each test prints the
+// failures it finds and returns false on any.
+//
+// usage: tests
+
+///////////////////////////////////////////////////////////////////////////////
+// Helpers
+///////////////////////////////////////////////////////////////////////////////
+
+template <typename NodePool>
+static uint32_t computeDepth(const NodePool& nodes, uint32_t nodeIndex)
+{
+    const BVHNode& node = nodes[nodeIndex];
+    if (node.isLeaf())
+        return 0;
+    return 1 + std::max(computeDepth(nodes, node.firstChild()), computeDepth(nodes, node.firstChild() + 1));
+}
+
+// unit height triangles in the z = 0 plane along x, positions and widths grow by
+// growth from one to the next. With 2 bins and growth > 2 every binned SAH split
+// cuts the farthest triangle off the rest. Box areas grow linearly with x, which
+// keeps SAH costs far from overflowing.
+static void generateSkewedTris(std::vector<Tri>& triangles, uint32_t count, float growth)
+{
+    triangles.clear();
+    float x = 1.0f;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        Tri tri;
+        tri.vertex0 = float3( x, 0.0f, 0.0f );
+        tri.vertex1 = float3( x * 1.1f, 0.0f, 0.0f );
+        tri.vertex2 = float3( x, 1.0f, 0.0f );
+        tri.centroid = (tri.vertex0 + tri.vertex1 + tri.vertex2) / 3.0f;
+        triangles.push_back(tri);
+        x *= growth;
+    }
+}
+
+// every triangle is hit near its right angle corner by a ray along +z
+template <typename AccelT>
+static uint32_t countMissedTris(AccelT& accel, const std::vector<Tri>& triangles)
+{
+    uint32_t missCount = 0;
+    for (uint32_t i = 0; i < triangles.size(); i++)
+    {
+        const Tri& tri = triangles[i];
+        float offset = 0.25f * (tri.vertex1.x - tri.vertex0.x);
+        Ray ray(float3( tri.vertex0.x + offset, 0.25f, -1.0f ), float3( 0.0f, 0.0f, 1.0f ));
+        accel.intersect(ray);
+        if (ray.hit.primId != i)
+            missCount++;
+    }
+    return missCount;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Tests
+///////////////////////////////////////////////////////////////////////////////
+
+static bool testBVHDepthLimit()
+{
+    std::vector<Tri> tris;
+    generateSkewedTris(tris, 75, 2.1f);
+
+    bool passed = true;
+    for (BVHBuildMethod method : { BVHBuildMethod_SweepSAH, BVHBuildMethod_BinnedSAH })
+    {
+        BVHBuildParams params;
+        params.method = method;
+        params.binCount = 2;
+        BVH bvh(tris.data(), uint32_t(tris.size()), params);
+
+        uint32_t depth = computeDepth(bvh.getNodes(), bvh.getRootNodeIndex());
+        uint32_t missCount = countMissedTris(bvh, tris);
+        if (depth > BVH::kMaxDepth || missCount > 0)
+        {
+            printf("  %s: depth %u (max %u), %u missed triangles\n", toString(method), depth, BVH::kMaxDepth, missCount);
+            passed = false;
+        }
+    }
+    return passed;
+}
+
+// Instances of a needle along x, spaced with gaps growing by 1.25. Their boxes have
+// no area, every SAH candidate ties at zero cost and the first one, which cuts the
+// farthest instance off the rest, wins.
+static bool testTLASDepthLimit()
+{
+    std::vector<Tri> needle(1);
+    needle[0].vertex0 = float3( 0.0f, 0.0f, 0.0f );
+    needle[0].vertex1 = float3( 1.0f, 0.0f, 0.0f );
+    needle[0].vertex2 = float3( 0.5f, 0.0f, 0.0f );
+    computeCentroids(needle);
+    BVH blas(needle.data(), uint32_t(needle.size()));
+
+    TLAS::Instances instances;
+    float x = 1.0f;
+    for (uint32_t i = 0; i < 100; i++)
+    {
+        instances.emplace_back(blas, float3x4::translation(float3( x, 0.0f, 0.0f )));
+        x *= 1.25f;
+    }
+    TLAS tlas(std::move(instances));
+
+    // every instance in exactly one leaf
+    std::vector<uint32_t> leafCounts(tlas.getInstanceCount(), 0);
+    for (const BVHNode& node : tlas.getNodes())
+    {
+        if (node.isLeaf())
+            leafCounts[node.firstItemRef()] += node.itemCount;
+    }
+    uint32_t misplacedCount = uint32_t(std::count_if(leafCounts.begin(), leafCounts.end(), [](uint32_t count) { return count != 1; }));
+
+    uint32_t depth = computeDepth(tlas.getNodes(), tlas.getRootNodeIndex());
+    if (depth > BVH::kMaxDepth || misplacedCount > 0)
+    {
+        printf("  depth %u (max %u), %u instance refs not in exactly one leaf\n", depth, BVH::kMaxDepth, misplacedCount);
+        return false;
+    }
+    return true;
+}
+
+// a default constructed ray and one turned with setDirection() intersect like
+// ones constructed with their direction
+static bool testRayDirection()
+{
+    std::vector<Tri> tris;
+    generateSkewedTris(tris, 1, 2.0f);
+    BVH bvh(tris.data(), uint32_t(tris.size()));
+
+    Ray ray;
+    ray.O = float3( 1.025f, 0.25f, -1.0f );
+    bvh.intersect(ray);
+    bool defaultHit = ray.hit.isValid();
+
+    ray.hit = Hit();
+    ray.setDirection(float3( 0.0f, 0.0f, -1.0f ));
+    bvh.intersect(ray);
+    bool turnedMiss = !ray.hit.isValid();
+
+    if (!defaultHit || !turnedMiss)
+    {
+        printf("  default ray %s, turned ray %s\n", defaultHit ? "hit" : "missed", turnedMiss ? "missed" : "hit");
+        return false;
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Main
+///////////////////////////////////////////////////////////////////////////////
+
+int main()
+{
+    struct Test
+    {
+        const char* name;
+        bool (*run)();
+    };
+    const Test tests[] =
+    {
+        { "BVH depth limit", testBVHDepthLimit },
+        { "TLAS depth limit", testTLASDepthLimit },
+        { "Ray direction", testRayDirection },
+    };
+
+    uint32_t failedCount = 0;
+    for (const Test& test : tests)
+    {
+        bool passed = test.run();
+        printf("%s: %s\n", test.name, passed ? "passed" : "FAILED");
+        failedCount += passed ? 0 : 1;
+    }
+    return failedCount == 0 ? 0 : 1;
+}